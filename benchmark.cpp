@@ -0,0 +1,221 @@
+// Time-to-quality benchmark: renders fixed scenes with camera::render_framebuffer, adding
+// samples in batches, and records the error against a stored high sample count reference at
+// regular wall-clock intervals.
+//
+// Usage: benchmark [--budget seconds] [--interval seconds] [--threshold rmse]
+//                  [--reference-spp n] [--width pixels] [--max-time seconds]
+//                  [--radiance-cache training-spp] [--threads n]
+//
+// Prints one JSON object per line: "sample" records while rendering and one "result" record
+// per scene. A scene fails if its error does not reach the threshold within --budget, or
+// within --max-time when that is given, and the exit status is then 1. Times are measured at
+// the end of each batch, so they are accurate to about one --interval.
+//
+// --max-time is the gating mode: references are never rendered then, since a reference made
+// by the build under test would hide its own regressions. A missing reference is an error
+// (exit status 2); run once without --max-time on a trusted build to create it.
+// A reference whose size does not match --width is treated like a missing one.
+//
+// --radiance-cache renders with a radiance cache trained during the given number of samples
+// per pixel; references never use it.
+#include "rtweekend.h"
+#include "camera.h"
+#include "framebuffer.h"
+#include "hittable_list.h"
+#include "bvh.h"
+#include "scenes.h"
+#include "radiance_cache.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct benchmark_scene {
+    std::string name;
+    std::function<void(hittable_list&)> build;
+};
+
+struct image_error {
+    double rmse = 0;
+    double relmse = 0;
+};
+
+image_error compare(const framebuffer& image, const framebuffer& reference) {
+    // Errors are measured on linear radiance, before gamma and 8-bit quantisation.
+    image_error error;
+    size_t n = image.pixels.size() * 3;
+    for (size_t k = 0; k < image.pixels.size(); k++) {
+        for (int c = 0; c < 3; c++) {
+            double x = image.pixels[k][c];
+            double r = reference.pixels[k][c];
+            error.rmse += (x - r) * (x - r);
+            error.relmse += (x - r) * (x - r) / (r * r + 0.01);
+        }
+    }
+    error.rmse = std::sqrt(error.rmse / n);
+    error.relmse /= n;
+    return error;
+}
+
+// Seeds of the per-tile random sequences. Reference and timed runs never share one, so their
+// noise is independent, and every run of the benchmark repeats the same samples.
+const unsigned reference_seed = 0x80000000u;
+unsigned batch_seed(int batch) { return unsigned(batch) + 1; }
+
+camera make_camera(int width) {
+    camera cam;
+    cam.aspect_ratio = 16.0 / 9.0;
+    cam.image_width  = width;
+    cam.max_depth    = 50;
+    return cam;
+}
+
+bool load_or_render_reference(const benchmark_scene& scene, const hittable& world, thread_pool& pool,
+                              int width, int reference_spp, bool gating, framebuffer& reference) {
+    std::string path = "reference_" + scene.name + "_" + std::to_string(width) + "_"
+                     + std::to_string(reference_spp) + ".pfm";
+    camera cam = make_camera(width);
+    int height = std::max(1, int(width / cam.aspect_ratio));  // As camera::initialize derives it
+
+    if (reference.load_pfm(path)) {
+        if (reference.width == width && reference.height == height)
+            return true;
+        std::cerr << "Warning: Reference " << path << " is " << reference.width << 'x' << reference.height
+                  << ", not " << width << 'x' << height << ".\n";
+        if (gating) {
+            std::cerr << "Error: Gating runs never render references; recreate it on a trusted build.\n";
+            return false;
+        }
+    }
+
+    if (gating) {
+        std::cerr << "Error: Missing reference " << path << ". Gating runs never render references; "
+                  << "run the benchmark without --max-time on a trusted build to create it.\n";
+        return false;
+    }
+
+    std::clog << "Rendering reference " << path << " at " << reference_spp << " spp\n";
+    cam.samples_per_pixel = reference_spp;
+    cam.random_seed = reference_seed;
+    reference = cam.render_framebuffer(world, pool);
+    return reference.save_pfm(path);
+}
+
+int main(int argc, char** argv) {
+    double budget = 10.0;
+    double sample_interval = 0.25;
+    double threshold = 0.02;
+    double max_time = 0;
+    int reference_spp = 1024;
+    int width = 200;
+    int cache_training_spp = 0;
+    unsigned threads = std::thread::hardware_concurrency();
+
+    for (int k = 1; k + 1 < argc; k += 2) {
+        if (!std::strcmp(argv[k], "--budget")) budget = std::atof(argv[k + 1]);
+        else if (!std::strcmp(argv[k], "--interval")) sample_interval = std::atof(argv[k + 1]);
+        else if (!std::strcmp(argv[k], "--threshold")) threshold = std::atof(argv[k + 1]);
+        else if (!std::strcmp(argv[k], "--max-time")) max_time = std::atof(argv[k + 1]);
+        else if (!std::strcmp(argv[k], "--reference-spp")) reference_spp = std::atoi(argv[k + 1]);
+        else if (!std::strcmp(argv[k], "--width")) width = std::atoi(argv[k + 1]);
+        else if (!std::strcmp(argv[k], "--radiance-cache")) cache_training_spp = std::atoi(argv[k + 1]);
+        else if (!std::strcmp(argv[k], "--threads")) threads = unsigned(std::atoi(argv[k + 1]));
+        else {
+            std::cerr << "Unknown option " << argv[k] << '\n';
+            return 2;
+        }
+    }
+
+    std::vector<benchmark_scene> scenes = {
+        {"main",        [](hittable_list& world) { build_main_scene(world); }},
+        {"random_200",  [](hittable_list& world) { build_random_scene(world, 200); }},
+        {"random_2000", [](hittable_list& world) { build_random_scene(world, 2000); }},
+    };
+
+    thread_pool pool(threads);
+    bool passed = true;
+
+    for (const auto& scene : scenes) {
+        hittable_list list;
+        scene.build(list);
+        bvh world(list);
+
+        framebuffer reference;
+        if (!load_or_render_reference(scene, world, pool, width, reference_spp, max_time > 0, reference))
+            return 2;
+
+        camera cam = make_camera(width);
+
+        radiance_cache cache;
+        if (cache_training_spp > 0)
+            cam.indirect_cache = &cache;
+
+        // Each batch is sized from the previous one to take about one sample interval. Only
+        // render_framebuffer calls are timed; merging batches and error evaluation are not.
+        double elapsed = 0;
+        double seconds_per_spp = 0;
+        double next_sample = 0;
+        double time_to_threshold = -1;
+        int final_spp = 0;
+        int batches = 0;
+
+        framebuffer frame;
+        while (elapsed < budget) {
+            int batch = 1;
+            if (seconds_per_spp > 0)
+                batch = std::max(1, int(std::min(sample_interval, budget - elapsed) / seconds_per_spp));
+            cam.samples_per_pixel = batch;
+            cam.cache_training_spp = std::max(0, cache_training_spp - final_spp);
+            cam.random_seed = batch_seed(batches++);
+
+            auto start = std::chrono::steady_clock::now();
+            framebuffer pass = cam.render_framebuffer(world, pool);
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            elapsed += seconds;
+            seconds_per_spp = seconds / batch;
+
+            if (frame.pixels.empty())
+                frame = pass;
+            else
+                for (size_t k = 0; k < frame.pixels.size(); k++)
+                    frame.pixels[k] = (final_spp * frame.pixels[k] + batch * pass.pixels[k]) / (final_spp + batch);
+            final_spp += batch;
+
+            image_error error = compare(frame, reference);
+            if (elapsed >= next_sample) {
+                std::cout << "{\"type\":\"sample\",\"scene\":\"" << scene.name << "\",\"time\":" << elapsed
+                          << ",\"spp\":" << final_spp << ",\"rmse\":" << error.rmse
+                          << ",\"relmse\":" << error.relmse << "}\n";
+                next_sample = elapsed + sample_interval;
+            }
+            if (time_to_threshold < 0 && error.rmse <= threshold)
+                time_to_threshold = elapsed;
+        }
+
+        image_error final_error = compare(frame, reference);
+        bool scene_passed = time_to_threshold >= 0 && (max_time <= 0 || time_to_threshold <= max_time);
+        passed = passed && scene_passed;
+
+        std::cout << "{\"type\":\"result\",\"scene\":\"" << scene.name << "\",\"objects\":" << list.objects.size()
+                  << ",\"width\":" << width << ",\"threads\":" << pool.size() << ",\"reference_spp\":" << reference_spp
+                  << ",\"threshold\":" << threshold << ",\"time_to_threshold\":";
+        if (time_to_threshold >= 0)
+            std::cout << time_to_threshold;
+        else
+            std::cout << "null";
+        std::cout << ",\"final_spp\":" << final_spp << ",\"final_rmse\":" << final_error.rmse
+                  << ",\"final_relmse\":" << final_error.relmse
+                  << ",\"radiance_cache\":" << (cache_training_spp > 0 ? "true" : "false")
+                  << ",\"cache_hit_rate\":" << cache.hit_rate()
+                  << ",\"passed\":" << (scene_passed ? "true" : "false") << "}" << std::endl;
+    }
+
+    return passed ? 0 : 1;
+}
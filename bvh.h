@@ -0,0 +1,487 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include "rtweekend.h"
+#include "hittable.h"
+#include "hittable_list.h"
+#include "aabb.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include <process.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Name for a temporary file next to `path` that no other process uses, so concurrent runs
+// writing the same cache never share one.
+inline std::string unique_temp_path(const std::string& path) {
+#ifdef _WIN32
+    return path + "." + std::to_string(_getpid()) + ".tmp";
+#else
+    return path + "." + std::to_string(getpid()) + ".tmp";
+#endif
+}
+
+// One node of the flattened hierarchy. The same layout is used in memory and in the cache
+// file: children and primitives are referred to by index, never by pointer, so a mapped file
+// can be traced directly wherever it lands in the address space.
+class bvh_node_data {
+  public:
+    double   minimum[3];
+    double   maximum[3];
+    uint32_t index;  // Interior: index of the right child (the left child is the next node).
+                     // Leaf: first entry in the primitive order.
+    uint32_t count;  // Number of primitives in a leaf, 0 for interior nodes
+    uint32_t axis;   // Split axis of an interior node
+    uint32_t unused;
+
+    bool is_leaf() const { return count > 0; }
+
+    bool hit_box(const ray& r, double t_min, double t_max) const {
+        for (int a = 0; a < 3; a++) {
+            auto invD = 1.0 / r.direction()[a];
+            auto t0 = (minimum[a] - r.origin()[a]) * invD;
+            auto t1 = (maximum[a] - r.origin()[a]) * invD;
+            if (invD < 0.0)
+                std::swap(t0, t1);
+            t_min = t0 > t_min ? t0 : t_min;
+            t_max = t1 < t_max ? t1 : t_max;
+            if (t_max <= t_min)
+                return false;
+        }
+        return true;
+    }
+};
+
+// Header of a cached hierarchy file. Nodes follow the header, then the primitive order.
+class bvh_file_header {
+  public:
+    char     magic[8];
+    uint32_t version;
+    uint32_t node_size;
+    uint64_t scene_hash;
+    uint64_t primitive_count;
+    uint64_t node_count;
+    uint64_t unused;
+};
+
+// Read-only view of a whole file, memory-mapped where the platform allows it so concurrent
+// render processes share the same physical pages.
+class mapped_file {
+  public:
+    mapped_file() {}
+    mapped_file(const mapped_file&) = delete;
+    mapped_file& operator=(const mapped_file&) = delete;
+    ~mapped_file() { close(); }
+
+    bool open(const std::string& path) {
+        close();
+#ifdef _WIN32
+        std::ifstream in(path, std::ios::binary | std::ios::ate);
+        if (!in)
+            return false;
+        buffer.resize(size_t(in.tellg()));
+        in.seekg(0);
+        if (!in.read(buffer.data(), buffer.size()))
+            return false;
+        bytes = buffer.data();
+        length = buffer.size();
+        return true;
+#else
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            return false;
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size == 0) {
+            ::close(fd);
+            return false;
+        }
+        void* p = mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (p == MAP_FAILED)
+            return false;
+        bytes = static_cast<const char*>(p);
+        length = size_t(st.st_size);
+        return true;
+#endif
+    }
+
+    void close() {
+#ifdef _WIN32
+        buffer.clear();
+#else
+        if (bytes)
+            munmap(const_cast<char*>(bytes), length);
+#endif
+        bytes = nullptr;
+        length = 0;
+    }
+
+    const char* data() const { return bytes; }
+    size_t size() const { return length; }
+
+  private:
+    const char* bytes = nullptr;
+    size_t length = 0;
+#ifdef _WIN32
+    std::vector<char> buffer;
+#endif
+};
+
+// Bounding volume hierarchy over the objects of a hittable_list. The hierarchy is stored as a
+// flat node array, either built in memory or mapped from a cache file written by an earlier
+// run on the same scene.
+class bvh : public hittable {
+  public:
+    static constexpr uint32_t file_version = 1;
+
+    bvh(const hittable_list& list) : primitives(list.objects) {
+        store_primitive_boxes();
+        build();
+    }
+
+    bvh(const hittable_list& list, const std::string& cache_path) : primitives(list.objects) {
+        // Maps the hierarchy from cache_path if it was built for this scene, otherwise builds
+        // it and writes the cache for the next run.
+        store_primitive_boxes();
+        if (load(cache_path)) {
+            std::clog << "Loaded BVH from " << cache_path << " (" << node_count << " nodes)\n";
+            return;
+        }
+        build();
+        if (save(cache_path))
+            std::clog << "Wrote BVH cache " << cache_path << " (" << node_count << " nodes)\n";
+    }
+
+    bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+        if (node_count == 0)
+            return false;
+
+        uint32_t stack[64];
+        int top = 0;
+        stack[top++] = 0;
+        hit_record temp_rec;
+        bool hit_anything = false;
+
+        while (top > 0) {
+            const bvh_node_data& node = nodes[stack[--top]];
+            if (!node.hit_box(r, ray_t.min, ray_t.max))
+                continue;
+
+            if (node.is_leaf()) {
+                for (uint32_t k = node.index; k < node.index + node.count; k++) {
+                    if (!primitive_box_hit(order[k], r, ray_t))
+                        continue;
+                    if (primitives[order[k]]->hit(r, ray_t, temp_rec)) {
+                        hit_anything = true;
+                        ray_t.max = temp_rec.t;
+                        rec = temp_rec;
+                    }
+                }
+                continue;
+            }
+
+            // Push the far child first so the near child is visited first.
+            uint32_t left = uint32_t(&node - nodes) + 1;
+            if (r.direction()[node.axis] < 0) {
+                stack[top++] = left;
+                stack[top++] = node.index;
+            } else {
+                stack[top++] = node.index;
+                stack[top++] = left;
+            }
+        }
+
+        return hit_anything;
+    }
+
+    bool occluded(const ray& r, interval ray_t) const override {
+        if (node_count == 0)
+            return false;
+
+        uint32_t stack[64];
+        int top = 0;
+        stack[top++] = 0;
+
+        while (top > 0) {
+            const bvh_node_data& node = nodes[stack[--top]];
+            if (!node.hit_box(r, ray_t.min, ray_t.max))
+                continue;
+
+            if (node.is_leaf()) {
+                for (uint32_t k = node.index; k < node.index + node.count; k++)
+                    if (primitive_box_hit(order[k], r, ray_t) && primitives[order[k]]->occluded(r, ray_t))
+                        return true;
+                continue;
+            }
+
+            stack[top++] = node.index;
+            stack[top++] = uint32_t(&node - nodes) + 1;
+        }
+
+        return false;
+    }
+
+    bool bounding_box(double time0, double time1, aabb& output_box) const override {
+        if (node_count == 0)
+            return false;
+        output_box = aabb(point3(nodes[0].minimum[0], nodes[0].minimum[1], nodes[0].minimum[2]),
+                          point3(nodes[0].maximum[0], nodes[0].maximum[1], nodes[0].maximum[2]));
+        return true;
+    }
+
+    uint64_t scene_hash() const {
+        // FNV-1a over the primitive count and every primitive's bounds, which is all the
+        // hierarchy depends on.
+        uint64_t hash = 14695981039346656037ull;
+        auto mix = [&hash](const void* p, size_t n) {
+            auto bytes = static_cast<const unsigned char*>(p);
+            for (size_t k = 0; k < n; k++) {
+                hash ^= bytes[k];
+                hash *= 1099511628211ull;
+            }
+        };
+
+        uint64_t count = primitives.size();
+        mix(&count, sizeof(count));
+        for (const auto& object : primitives) {
+            aabb box = bounds_of(*object);
+            mix(box.minimum.e, sizeof(box.minimum.e));
+            mix(box.maximum.e, sizeof(box.maximum.e));
+        }
+        return hash;
+    }
+
+  private:
+    std::vector<shared_ptr<hittable>> primitives;  // Scene objects in their original order
+    std::vector<aabb> primitive_boxes;              // Bounding box of each primitive
+    std::vector<char> primitive_bounded;            // Whether the primitive has a bounding box
+
+    // Either point into the vectors below or into the mapped cache file.
+    const bvh_node_data* nodes = nullptr;
+    const uint32_t*      order = nullptr;
+    size_t               node_count = 0;
+
+    std::vector<bvh_node_data> built_nodes;
+    std::vector<uint32_t>      built_order;
+    mapped_file                file;
+
+    static constexpr uint32_t max_leaf_size = 2;
+    static constexpr uint8_t  max_depth = 62;  // Keeps traversal within its 64-entry stack
+
+    void store_primitive_boxes() {
+        primitive_boxes.resize(primitives.size());
+        primitive_bounded.resize(primitives.size());
+        for (size_t k = 0; k < primitives.size(); k++)
+            primitive_bounded[k] = primitives[k]->bounding_box(0, 0, primitive_boxes[k]);
+    }
+
+    bool primitive_box_hit(uint32_t index, const ray& r, interval ray_t) const {
+        // The same per-object test hittable_list makes, including skipping objects without a
+        // box, so traversing the hierarchy finds exactly the hits the list would.
+        return primitive_bounded[index] && primitive_boxes[index].hit(r, ray_t.min, ray_t.max);
+    }
+
+    static aabb bounds_of(const hittable& object) {
+        aabb box;
+        if (!object.bounding_box(0, 0, box))
+            box = aabb(point3(-infinity, -infinity, -infinity), point3(infinity, infinity, infinity));
+        return box;
+    }
+
+    void build() {
+        built_nodes.clear();
+        built_order.resize(primitives.size());
+        for (size_t k = 0; k < built_order.size(); k++)
+            built_order[k] = uint32_t(k);
+
+        std::vector<aabb> boxes;
+        boxes.reserve(primitives.size());
+        for (const auto& object : primitives)
+            boxes.push_back(bounds_of(*object));
+
+        if (!primitives.empty()) {
+            built_nodes.reserve(2 * primitives.size());
+            build_node(boxes, 0, uint32_t(primitives.size()));
+        }
+
+        nodes = built_nodes.data();
+        order = built_order.data();
+        node_count = built_nodes.size();
+    }
+
+    uint32_t build_node(const std::vector<aabb>& boxes, uint32_t begin, uint32_t end) {
+        uint32_t node_index = uint32_t(built_nodes.size());
+        built_nodes.push_back(bvh_node_data());
+
+        aabb box = boxes[built_order[begin]];
+        for (uint32_t k = begin + 1; k < end; k++)
+            box = surrounding_box(box, boxes[built_order[k]]);
+
+        auto& node = built_nodes[node_index];
+        for (int a = 0; a < 3; a++) {
+            node.minimum[a] = box.minimum[a];
+            node.maximum[a] = box.maximum[a];
+        }
+
+        if (end - begin <= max_leaf_size) {
+            node.index = begin;
+            node.count = end - begin;
+            return node_index;
+        }
+
+        // Median split along the longest axis of the primitive centers.
+        auto center = [&boxes](uint32_t k, int a) {
+            return 0.5 * (boxes[k].minimum[a] + boxes[k].maximum[a]);
+        };
+        point3 lo( infinity,  infinity,  infinity);
+        point3 hi(-infinity, -infinity, -infinity);
+        for (uint32_t k = begin; k < end; k++) {
+            for (int a = 0; a < 3; a++) {
+                lo[a] = std::fmin(lo[a], center(built_order[k], a));
+                hi[a] = std::fmax(hi[a], center(built_order[k], a));
+            }
+        }
+        int axis = 0;
+        for (int a = 1; a < 3; a++)
+            if (hi[a] - lo[a] > hi[axis] - lo[axis])
+                axis = a;
+
+        uint32_t mid = begin + (end - begin) / 2;
+        std::nth_element(built_order.begin() + begin, built_order.begin() + mid,
+                         built_order.begin() + end,
+                         [&](uint32_t a, uint32_t b) { return center(a, axis) < center(b, axis); });
+
+        build_node(boxes, begin, mid);
+        uint32_t right = build_node(boxes, mid, end);
+
+        // built_nodes may have reallocated during recursion.
+        built_nodes[node_index].index = right;
+        built_nodes[node_index].count = 0;
+        built_nodes[node_index].axis = uint32_t(axis);
+        return node_index;
+    }
+
+    static void fill_header(bvh_file_header& header) {
+        std::memset(&header, 0, sizeof(header));
+        std::memcpy(header.magic, "RTBVH\0\0\0", 8);
+        header.version = file_version;
+        header.node_size = sizeof(bvh_node_data);
+    }
+
+    bool load(const std::string& path) {
+        if (!file.open(path))
+            return false;
+
+        bvh_file_header expected;
+        fill_header(expected);
+        expected.scene_hash = scene_hash();
+        expected.primitive_count = primitives.size();
+
+        const char* data = file.data();
+        if (file.size() < sizeof(bvh_file_header)) {
+            file.close();
+            return false;
+        }
+        bvh_file_header header;
+        std::memcpy(&header, data, sizeof(header));
+
+        size_t expected_size = sizeof(bvh_file_header)
+                             + header.node_count * sizeof(bvh_node_data)
+                             + header.primitive_count * sizeof(uint32_t);
+        if (std::memcmp(header.magic, expected.magic, 8) != 0
+            || header.version != expected.version
+            || header.node_size != expected.node_size
+            || header.scene_hash != expected.scene_hash
+            || header.primitive_count != expected.primitive_count
+            || file.size() != expected_size) {
+            file.close();
+            return false;
+        }
+
+        auto mapped_nodes = reinterpret_cast<const bvh_node_data*>(data + sizeof(bvh_file_header));
+        auto mapped_order = reinterpret_cast<const uint32_t*>(mapped_nodes + header.node_count);
+        if (!valid_hierarchy(mapped_nodes, size_t(header.node_count), mapped_order)) {
+            std::cerr << "Warning: Ignoring corrupt BVH cache " << path << ".\n";
+            file.close();
+            return false;
+        }
+
+        nodes = mapped_nodes;
+        order = mapped_order;
+        node_count = size_t(header.node_count);
+        return true;
+    }
+
+    bool valid_hierarchy(const bvh_node_data* file_nodes, size_t count, const uint32_t* file_order) const {
+        // Checks every index in a cache file before it is traced, so a damaged file is rebuilt
+        // rather than read out of bounds. Children always follow their parent, and the depth is
+        // bounded by the traversal stack.
+        if (count == 0)
+            return primitives.empty();
+
+        for (size_t k = 0; k < primitives.size(); k++)
+            if (file_order[k] >= primitives.size())
+                return false;
+
+        std::vector<uint8_t> depth(count, 0);
+        for (size_t k = 0; k < count; k++) {
+            const auto& node = file_nodes[k];
+            if (node.is_leaf()) {
+                if (node.index > primitives.size() || node.count > primitives.size() - node.index)
+                    return false;
+                continue;
+            }
+            if (node.axis > 2 || node.index <= k + 1 || node.index >= count || depth[k] >= max_depth)
+                return false;
+            auto child_depth = uint8_t(depth[k] + 1);
+            depth[k + 1] = std::max(depth[k + 1], child_depth);
+            depth[node.index] = std::max(depth[node.index], child_depth);
+        }
+        return true;
+    }
+
+    bool save(const std::string& path) const {
+        // Written to a temporary name and renamed, so a concurrent reader never maps a
+        // partially written file.
+        bvh_file_header header;
+        fill_header(header);
+        header.scene_hash = scene_hash();
+        header.primitive_count = primitives.size();
+        header.node_count = node_count;
+
+        std::string temp_path = unique_temp_path(path);
+        {
+            std::ofstream out(temp_path, std::ios::binary | std::ios::trunc);
+            if (!out) {
+                std::cerr << "Error: Could not open " << temp_path << " for writing.\n";
+                return false;
+            }
+            out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+            out.write(reinterpret_cast<const char*>(nodes), node_count * sizeof(bvh_node_data));
+            out.write(reinterpret_cast<const char*>(order), primitives.size() * sizeof(uint32_t));
+            if (!out) {
+                out.close();
+                std::remove(temp_path.c_str());
+                return false;
+            }
+        }
+#ifdef _WIN32
+        std::remove(path.c_str());
+#endif
+        return std::rename(temp_path.c_str(), path.c_str()) == 0;
+    }
+};
+
+#endif
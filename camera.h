@@ -6,8 +6,19 @@
 #include "color.h"
 #include "HelperFunctions.h"
 #include "material.h"
+#include "framebuffer.h"
+#include "gbuffer.h"
+#include "thread_pool.h"
+#include "radiance_cache.h"
 
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
 #include <fstream>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
 
 class camera {
   public:
@@ -17,6 +28,28 @@ class camera {
     int    samples_per_pixel = 10;   // Count of random samples for each pixel 
     int    max_depth         = 10;   // Maximum number of ray bounces into scene
 
+    double vfov     = 90;              // Vertical view angle (field of view)
+    point3 lookfrom = point3(0,0,0);   // Point camera is looking from
+    point3 lookat   = point3(0,0,-1);  // Point camera is looking at
+    vec3   vup      = vec3(0,1,0);     // Camera-relative "up" direction
+
+    /* Sampling Parameters */
+    unsigned random_seed = 0;  // If nonzero, tiled renders reseed per tile from this and repeat exactly
+
+    /* Preview Mode Parameters */
+    double preview_time_budget = 1.0;      // Wall-clock seconds before the preview is written
+    int    preview_start_block = 16;       // Pixel block size of the first, coarsest pass
+    std::ostream* preview_stream = nullptr; // If set, every intermediate frame is written here as binary PPM
+
+    /* Radiance Cache Parameters */
+    radiance_cache* indirect_cache = nullptr;  // If set, used for diffuse indirect light
+    int    cache_training_spp  = 8;   // Samples per pixel that fill the cache before it is used
+    int    cache_after_bounces = 1;   // Diffuse hits at least this many bounces deep read the cache
+
+    /* Ambient Occlusion Parameters */
+    int    ao_samples  = 16;   // Occlusion rays per primary hit
+    double ao_distance = 1.0;  // Geometry further away than this does not occlude
+
     void render(const hittable& world) {
         initialize();
 
@@ -43,6 +76,277 @@ class camera {
 
         std::clog << "\rDone.                 \n";
     }
+
+    static std::vector<framebuffer> render_batch(
+        std::vector<camera>& views, const hittable& world, thread_pool& pool, int tile_size = 32
+    ) {
+        // Renders every view of the same scene in one go. Tiles from all views go into a
+        // single work list on the shared pool, so views finish together and small views do
+        // not leave threads idle.
+        struct tile { size_t view; int x0, y0; };
+
+        std::vector<framebuffer> frames;
+        std::vector<tile> tiles;
+        for (size_t k = 0; k < views.size(); k++) {
+            auto& cam = views[k];
+            cam.initialize();
+            frames.emplace_back(cam.image_width, cam.image_height);
+            for (int y = 0; y < cam.image_height; y += tile_size)
+                for (int x = 0; x < cam.image_width; x += tile_size)
+                    tiles.push_back({k, x, y});
+        }
+
+        std::atomic<size_t> tiles_done{0};
+        for (int phase = 0; phase < 2; phase++) {
+            pool.parallel_for(tiles.size(), [&](size_t k) {
+                const auto& t = tiles[k];
+                const auto& cam = views[t.view];
+                int begin, end;
+                cam.sample_phase(phase, begin, end);
+                if (begin == end)
+                    return;
+                cam.render_tile(world, frames[t.view], t.x0, t.y0,
+                                std::min(t.x0 + tile_size, cam.image_width),
+                                std::min(t.y0 + tile_size, cam.image_height), 0, 0, begin, end);
+                size_t done = ++tiles_done;
+                if (done % 64 == 0)
+                    std::clog << "\rTiles done: " << done << ' ' << std::flush;
+            });
+        }
+        std::clog << "\rDone.                          \n";
+
+        return frames;
+    }
+
+    framebuffer render_framebuffer(
+        const hittable& world, thread_pool& pool,
+        int x0 = 0, int y0 = 0, int x1 = -1, int y1 = -1, int tile_size = 32
+    ) {
+        // Renders the image region [x0,x1) x [y0,y1) into memory and returns it; negative
+        // x1 or y1 mean the right or bottom edge. Nothing is written to disk or logged.
+        initialize();
+
+        x0 = std::max(x0, 0);
+        y0 = std::max(y0, 0);
+        x1 = (x1 < 0) ? image_width : std::min(x1, image_width);
+        y1 = (y1 < 0) ? image_height : std::min(y1, image_height);
+        if (x1 <= x0 || y1 <= y0)
+            return framebuffer();
+
+        framebuffer frame(x1 - x0, y1 - y0);
+        int tiles_x = (frame.width + tile_size - 1) / tile_size;
+        int tiles_y = (frame.height + tile_size - 1) / tile_size;
+
+        for (int phase = 0; phase < 2; phase++) {
+            int begin, end;
+            sample_phase(phase, begin, end);
+            if (begin == end)
+                continue;
+            pool.parallel_for(size_t(tiles_x) * tiles_y, [&](size_t k) {
+                int tx = x0 + int(k % tiles_x) * tile_size;
+                int ty = y0 + int(k / tiles_x) * tile_size;
+                render_tile(world, frame, tx, ty, std::min(tx + tile_size, x1), std::min(ty + tile_size, y1),
+                            x0, y0, begin, end);
+            });
+        }
+
+        return frame;
+    }
+
+    bool render_banded(const hittable& world, const std::string& path, thread_pool& pool, int band_height = 16) {
+        // Renders to a binary PPM without ever holding the whole image. Workers take bands of
+        // band_height rows, render them into a byte buffer, write that buffer at its final
+        // offset in the file and free it. Peak memory is about one band per thread whatever
+        // the resolution, and bands may finish in any order.
+        //
+        // indirect_cache is not used: training it before any pixel reads it would mean keeping
+        // every pixel's training samples, which is the whole image this mode avoids holding.
+        if (band_height < 1) {
+            std::cerr << "Error: Band height must be at least 1, not " << band_height << ".\n";
+            return false;
+        }
+        initialize();
+
+        std::ofstream outfile(path, std::ios::binary | std::ios::trunc);
+        if (!outfile) {
+            std::cerr << "Error: Could not open " << path << " for writing.\n";
+            return false;
+        }
+
+        std::string header = "P6\n" + std::to_string(image_width) + ' '
+                           + std::to_string(image_height) + "\n255\n";
+        outfile.write(header.data(), header.size());
+
+        const uint64_t row_bytes = uint64_t(image_width) * 3;
+        const int band_count = (image_height + band_height - 1) / band_height;
+        std::mutex file_mutex;
+        std::atomic<int> bands_done{0};
+        bool write_failed = false;
+
+        pool.parallel_for(size_t(band_count), [&](size_t band) {
+            int y0 = int(band) * band_height;
+            int y1 = std::min(y0 + band_height, image_height);
+            std::vector<unsigned char> bytes(row_bytes * (y1 - y0));
+
+            for (int j = y0; j < y1; j++) {
+                for (int i = 0; i < image_width; i++) {
+                    color pixel_color(0,0,0);
+                    for (int sample = 0; sample < samples_per_pixel; sample++)
+                        pixel_color += ray_color(get_ray(i, j), max_depth, world);
+                    color_to_bytes(pixel_samples_scale * pixel_color, &bytes[row_bytes * (j - y0) + 3 * size_t(i)]);
+                }
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(file_mutex);
+                outfile.seekp(std::streamoff(header.size() + row_bytes * y0));
+                outfile.write(reinterpret_cast<const char*>(bytes.data()), std::streamsize(bytes.size()));
+                write_failed = write_failed || !outfile;
+                std::clog << "\rBands done: " << ++bands_done << " / " << band_count << ' ' << std::flush;
+            }
+        });
+
+        std::clog << "\rDone.                          \n";
+        if (write_failed) {
+            std::cerr << "Error: Could not write " << path << ".\n";
+            return false;
+        }
+        return true;
+    }
+
+    void render(const hittable& world, gbuffer& cache) {
+        // Same image as render(world), but primary hits are recorded in `cache`. When the cache
+        // already matches this camera, primary intersection is skipped and only pixels whose
+        // first-hit material changed are re-shaded.
+        initialize();
+
+        if (cache.matches(image_width, image_height, samples_per_pixel, max_depth,
+                          center, pixel00_loc, pixel_delta_u, pixel_delta_v))
+            reshade(world, cache);
+        else
+            trace_primary(world, cache);
+
+        framebuffer frame(image_width, image_height);
+        for (size_t k = 0; k < frame.pixels.size(); k++)
+            frame.pixels[k] = pixel_samples_scale * cache.radiance[k];
+        frame.save("output.ppm");
+    }
+
+    void render_ambient_occlusion(const hittable& world) {
+        // Grey-scale ambient occlusion image: each primary hit is shaded by the fraction of
+        // cosine-weighted occlusion rays that escape within ao_distance. Uses only the
+        // any-hit occluded() query after the primary hit, so it doubles as its benchmark.
+        initialize();
+
+        framebuffer frame(image_width, image_height);
+        long long occlusion_rays = 0;
+        auto start = std::chrono::steady_clock::now();
+
+        for (int j = 0; j < image_height; j++) {
+            std::clog << "\rScanlines remaining: " << (image_height - j) << ' ' << std::flush;
+            for (int i = 0; i < image_width; i++) {
+                double visible = 0;
+                for (int sample = 0; sample < samples_per_pixel; sample++) {
+                    ray r = get_ray(i, j);
+                    hit_record rec;
+                    if (!world.hit(r, interval(0.001, infinity), rec)) {
+                        visible += 1;
+                        continue;
+                    }
+
+                    int unoccluded = 0;
+                    for (int k = 0; k < ao_samples; k++) {
+                        auto direction = rec.normal + random_unit_vector();
+                        if (direction.near_zero())
+                            direction = rec.normal;
+                        ray probe(rec.p, unit_vector(direction));
+                        if (!world.occluded(probe, interval(0.001, ao_distance)))
+                            unoccluded++;
+                    }
+                    occlusion_rays += ao_samples;
+                    visible += double(unoccluded) / ao_samples;
+                }
+                auto v = pixel_samples_scale * visible;
+                frame.at(i, j) = color(v, v, v);
+            }
+        }
+
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        std::clog << "\rDone.                 \n";
+        std::clog << "Occlusion rays: " << occlusion_rays << " in " << elapsed.count() << " s ("
+                  << occlusion_rays / elapsed.count() / 1e6 << " Mrays/s, primary ray time included)\n";
+        frame.save("output.ppm");
+    }
+
+    void render_preview(const hittable& world) {
+        // Renders progressively until preview_time_budget runs out, then writes the best
+        // image available at that point to output.ppm.
+        auto deadline = std::chrono::steady_clock::now()
+                      + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                            std::chrono::duration<double>(preview_time_budget));
+
+        framebuffer frame;
+        render_progressive(world, deadline, frame, [this](const framebuffer& f, int samples) {
+            std::clog << "\rPreview samples per pixel: " << samples << ' ' << std::flush;
+            if (preview_stream) {
+                f.write_binary_ppm(*preview_stream);
+                preview_stream->flush();
+            }
+        });
+
+        std::clog << "\rDone.                          \n";
+        frame.save("output.ppm");
+    }
+
+    void render_progressive(
+        const hittable& world, std::chrono::steady_clock::time_point deadline, framebuffer& frame,
+        const std::function<void(const framebuffer&, int)>& on_pass
+    ) {
+        // Fills `frame` in passes of increasing quality until the deadline or until
+        // samples_per_pixel is reached. The first passes trace one sample per block of
+        // pixels, halving the block size each pass; after that each pass adds one sample to
+        // every pixel. on_pass is called with the frame and the full-resolution sample count
+        // (0 while still refining the resolution) after each completed pass.
+        initialize();
+        frame = framebuffer(image_width, image_height);
+
+        auto out_of_time = [&deadline]() { return std::chrono::steady_clock::now() >= deadline; };
+
+        // Coarse passes. A pass cut short by the deadline leaves the previous, coarser
+        // values in the blocks it did not reach.
+        for (int block = preview_start_block; block > 1; block /= 2) {
+            for (int j = 0; j < image_height; j += block) {
+                if (out_of_time())
+                    return;
+                for (int i = 0; i < image_width; i += block) {
+                    int block_w = std::min(block, image_width - i);
+                    int block_h = std::min(block, image_height - j);
+                    color pixel_color = ray_color(get_ray(i + block_w/2, j + block_h/2), max_depth, world);
+                    for (int y = j; y < j + block_h; y++)
+                        for (int x = i; x < i + block_w; x++)
+                            frame.at(x, y) = pixel_color;
+                }
+            }
+            on_pass(frame, 0);
+        }
+
+        // Full resolution passes. Each pixel is rewritten with its running average, so a
+        // pass cut short by the deadline leaves rows that are one sample behind.
+        std::vector<color> sums(frame.pixels.size());
+
+        for (int pass = 1; pass <= samples_per_pixel; pass++) {
+            for (int j = 0; j < image_height; j++) {
+                if (out_of_time())
+                    return;
+                for (int i = 0; i < image_width; i++) {
+                    auto& sum = sums[size_t(j) * image_width + i];
+                    sum += ray_color(get_ray(i, j), max_depth, world, cache_use_for(pass - 1));
+                    frame.at(i, j) = sum / pass;
+                }
+            }
+            on_pass(frame, pass);
+        }
+    }
  private:
     int    image_height;         // Rendered image height
     double pixel_samples_scale;  // Color scale factor for a sum of pixel samples
@@ -50,6 +354,7 @@ class camera {
     point3 pixel00_loc;          // Location of pixel 0, 0
     vec3   pixel_delta_u;        // Offset to pixel to the right
     vec3   pixel_delta_v;        // Offset to pixel below
+    vec3   u, v, w;              // Camera frame basis vectors
 
     void initialize() {
         image_height = int(image_width / aspect_ratio);
@@ -57,16 +362,23 @@ class camera {
 
         pixel_samples_scale = 1.0 / samples_per_pixel;
 
-        center = point3(0, 0, 0);
+        center = lookfrom;
 
         // Determine viewport dimensions.
-        auto focal_length = 1.0;
-        auto viewport_height = 2.0;
+        auto focal_length = (lookfrom - lookat).length();
+        auto theta = degrees_to_radians(vfov);
+        auto h = std::tan(theta/2);
+        auto viewport_height = 2 * h * focal_length;
         auto viewport_width = viewport_height * (double(image_width)/image_height);
 
+        // Calculate the u,v,w unit basis vectors for the camera coordinate frame.
+        w = unit_vector(lookfrom - lookat);
+        u = unit_vector(cross(vup, w));
+        v = cross(w, u);
+
         // Calculate the vectors across the horizontal and down the vertical viewport edges.
-        auto viewport_u = vec3(viewport_width, 0, 0);
-        auto viewport_v = vec3(0, -viewport_height, 0);
+        auto viewport_u = viewport_width * u;    // Vector across viewport horizontal edge
+        auto viewport_v = viewport_height * -v;  // Vector down viewport vertical edge
 
         // Calculate the horizontal and vertical delta vectors from pixel to pixel.
         pixel_delta_u = viewport_u / image_width;
@@ -74,7 +386,7 @@ class camera {
 
         // Calculate the location of the upper left pixel.
         auto viewport_upper_left =
-            center - vec3(0, 0, focal_length) - viewport_u/2 - viewport_v/2;
+            center - (focal_length * w) - viewport_u/2 - viewport_v/2;
         pixel00_loc = viewport_upper_left + 0.5 * (pixel_delta_u + pixel_delta_v);
 
 
@@ -100,21 +412,165 @@ class camera {
         return vec3(random_double() - 0.5, random_double() - 0.5, 0);
     }
     
-        color ray_color(const ray& r, int depth, const hittable& world) const {
+    enum class cache_use { none, record, reuse };
+
+    cache_use cache_use_for(int sample) const {
+        if (!indirect_cache)
+            return cache_use::none;
+        return sample < cache_training_spp ? cache_use::record : cache_use::reuse;
+    }
+
+    void sample_phase(int phase, int& begin, int& end) const {
+        // Splits the pixel samples into the cache training phase (0) and the rest (1), so
+        // every pixel has trained the cache before any pixel reads it. Without a cache all
+        // samples fall in phase 1.
+        int split = indirect_cache ? std::clamp(cache_training_spp, 0, samples_per_pixel) : 0;
+        begin = phase == 0 ? 0 : split;
+        end   = phase == 0 ? split : samples_per_pixel;
+    }
+
+    unsigned tile_seed(int x0, int y0, int sample_begin) const {
+        // Seed for one tile's samples, whichever thread renders it.
+        uint64_t h = random_seed;
+        for (uint64_t v : {uint64_t(uint32_t(x0)), uint64_t(uint32_t(y0)), uint64_t(uint32_t(sample_begin))}) {
+            h ^= v + 0x9e3779b97f4a7c15ull + (h << 6) + (h >> 2);
+            h *= 0xff51afd7ed558ccdull;
+        }
+        return unsigned(h ^ (h >> 32));
+    }
+
+    void render_tile(
+        const hittable& world, framebuffer& frame, int x0, int y0, int x1, int y1,
+        int frame_x = 0, int frame_y = 0, int sample_begin = 0, int sample_end = -1
+    ) const {
+        // Adds samples [sample_begin, sample_end) of image pixels [x0,x1) x [y0,y1) to
+        // `frame`, which starts out black. Image pixel (frame_x, frame_y) is stored at the top
+        // left corner of `frame`.
+        if (sample_end < 0)
+            sample_end = samples_per_pixel;
+        if (random_seed != 0)
+            seed_random(tile_seed(x0, y0, sample_begin));
+        for (int j = y0; j < y1; j++) {
+            for (int i = x0; i < x1; i++) {
+                color pixel_color(0,0,0);
+                for (int sample = sample_begin; sample < sample_end; sample++)
+                    pixel_color += ray_color(get_ray(i, j), max_depth, world, cache_use_for(sample));
+                frame.at(i - frame_x, j - frame_y) += pixel_samples_scale * pixel_color;
+            }
+        }
+    }
+
+    void trace_primary(const hittable& world, gbuffer& cache) const {
+        cache.reset(image_width, image_height, samples_per_pixel, max_depth,
+                    center, pixel00_loc, pixel_delta_u, pixel_delta_v);
+
+        for (int j = 0; j < image_height; j++) {
+            std::clog << "\rScanlines remaining: " << (image_height - j) << ' ' << std::flush;
+            for (int i = 0; i < image_width; i++) {
+                gbuffer_sample* samples = cache.pixel_samples(i, j);
+                color pixel_color(0,0,0);
+                for (int sample = 0; sample < samples_per_pixel; sample++) {
+                    ray r = get_ray(i, j);
+                    hit_record rec;
+                    auto& s = samples[sample];
+                    s.set_direction(r.direction());
+
+                    if (!world.hit(r, interval(0.001, infinity), rec)) {
+                        pixel_color += background(r);
+                        continue;
+                    }
+
+                    s.set_hit(rec);
+                    s.mat_revision = uint32_t(s.mat->revision());
+                    pixel_color += shade_hit(r, rec, max_depth, world, s.mat);
+                }
+                cache.radiance[size_t(j) * image_width + i] = pixel_color;
+            }
+        }
+
+        std::clog << "\rDone.                 \n";
+    }
+
+    void reshade(const hittable& world, gbuffer& cache) const {
+        size_t reshaded = 0;
+
+        for (int j = 0; j < image_height; j++) {
+            for (int i = 0; i < image_width; i++) {
+                gbuffer_sample* samples = cache.pixel_samples(i, j);
+
+                bool stale = false;
+                for (int sample = 0; sample < samples_per_pixel && !stale; sample++)
+                    stale = samples[sample].mat
+                         && uint32_t(samples[sample].mat->revision()) != samples[sample].mat_revision;
+                if (!stale)
+                    continue;
+
+                color pixel_color(0,0,0);
+                for (int sample = 0; sample < samples_per_pixel; sample++) {
+                    auto& s = samples[sample];
+                    ray r(center, s.ray_direction());
+                    if (!s.object) {
+                        pixel_color += background(r);
+                        continue;
+                    }
+
+                    hit_record rec;
+                    rec.t = s.hit_t();
+                    rec.p = r.at(rec.t);
+                    rec.normal = s.hit_normal();
+                    rec.front_face = s.front_face();
+                    rec.object = s.object;  // rec.mat stays unset: shade_hit takes the material explicitly
+                    s.mat_revision = uint32_t(s.mat->revision());
+                    pixel_color += shade_hit(r, rec, max_depth, world, s.mat);
+                }
+                cache.radiance[size_t(j) * image_width + i] = pixel_color;
+                reshaded++;
+            }
+        }
+
+        std::clog << "Re-shaded " << reshaded << " of " << size_t(image_width) * image_height
+                  << " pixels from the primary hit cache.\n";
+    }
+
+    color ray_color(const ray& r, int depth, const hittable& world, cache_use use = cache_use::none) const {
         // If we've exceeded the ray bounce limit, no more light is gathered.
         if (depth <= 0)
             return color(0,0,0);
-        
+
         hit_record rec;
 
-        if (world.hit(r, interval(0.001, infinity), rec)) {
-                        ray scattered;
-            color attenuation;
-            if (rec.mat->scatter(r, rec, attenuation, scattered))
-                return attenuation * ray_color(scattered, depth-1, world);
+        if (world.hit(r, interval(0.001, infinity), rec))
+            return shade_hit(r, rec, depth, world, rec.mat.get(), use);
+
+        return background(r);
+    }
+
+    color shade_hit(
+        const ray& r, const hit_record& rec, int depth, const hittable& world, const material* mat,
+        cache_use use = cache_use::none
+    ) const {
+        ray scattered;
+        color attenuation;
+        if (!mat->scatter(r, rec, attenuation, scattered))
             return color(0,0,0);
-        }
 
+        if (use == cache_use::none || !mat->is_diffuse())
+            return attenuation * ray_color(scattered, depth-1, world, use);
+
+        // Deep enough diffuse hits take their incoming light from the cache instead of
+        // tracing the rest of the path.
+        color incoming;
+        if (use == cache_use::reuse && max_depth - depth >= cache_after_bounces
+            && indirect_cache->lookup(rec.p, rec.normal, incoming))
+            return attenuation * incoming;
+
+        incoming = ray_color(scattered, depth-1, world, use);
+        if (use == cache_use::record)
+            indirect_cache->record(rec.p, rec.normal, incoming);
+        return attenuation * incoming;
+    }
+
+    color background(const ray& r) const {
         vec3 unit_direction = unit_vector(r.direction());
         auto a = 0.5*(unit_direction.y() + 1.0);
         return (1.0-a)*color(1.0, 1.0, 1.0) + a*color(0.5, 0.7, 1.0);
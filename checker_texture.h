@@ -11,6 +11,11 @@ public:
     checker_texture(const color& c1, const color& c2, double scale = 10.0)
         : odd(c1), even(c2), frequency(scale) {}
 
+    void set_colors(const color& c1, const color& c2) { odd = c1; even = c2; touch(); }
+    void set_frequency(double scale) { frequency = scale; touch(); }
+
+    bool is_diffuse() const override { return true; }
+
     virtual bool scatter(
         const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered
     ) const override {
@@ -16,7 +16,7 @@ inline double linear_to_gamma(double linear_component)
     return 0;
 }
 
-void write_color(std::ostream& out, const color& pixel_color) {
+void color_to_bytes(const color& pixel_color, unsigned char bytes[3]) {
     auto r = pixel_color.x();
     auto g = pixel_color.y();
     auto b = pixel_color.z();
@@ -28,12 +28,17 @@ void write_color(std::ostream& out, const color& pixel_color) {
 
     // Translate the [0,1] component values to the byte range [0,255].
     static const interval intensity(0.000, 0.999);
-    int rbyte = int(256 * intensity.clamp(r));
-    int gbyte = int(256 * intensity.clamp(g));
-    int bbyte = int(256 * intensity.clamp(b));
+    bytes[0] = (unsigned char)(256 * intensity.clamp(r));
+    bytes[1] = (unsigned char)(256 * intensity.clamp(g));
+    bytes[2] = (unsigned char)(256 * intensity.clamp(b));
+}
+
+void write_color(std::ostream& out, const color& pixel_color) {
+    unsigned char bytes[3];
+    color_to_bytes(pixel_color, bytes);
 
     // Write out the pixel color components.
-    out << rbyte << ' ' << gbyte << ' ' << bbyte << '\n';
+    out << int(bytes[0]) << ' ' << int(bytes[1]) << ' ' << int(bytes[2]) << '\n';
 }
 
 #endif
\ No newline at end of file
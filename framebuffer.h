@@ -0,0 +1,92 @@
+#ifndef FRAMEBUFFER_H
+#define FRAMEBUFFER_H
+
+#include "rtweekend.h"
+#include "color.h"
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+class framebuffer {
+  public:
+    int width  = 0;
+    int height = 0;
+    std::vector<color> pixels;  // Row-major, top row first
+
+    framebuffer() {}
+    framebuffer(int width, int height)
+      : width(width), height(height), pixels(size_t(width) * height) {}
+
+    color& at(int i, int j) { return pixels[size_t(j) * width + i]; }
+    const color& at(int i, int j) const { return pixels[size_t(j) * width + i]; }
+
+    void write_ppm(std::ostream& out) const {
+        // Plain text PPM, the same format camera::render produces.
+        out << "P3\n" << width << ' ' << height << "\n255\n";
+        for (const auto& pixel : pixels)
+            write_color(out, pixel);
+    }
+
+    void write_binary_ppm(std::ostream& out) const {
+        // Binary PPM, compact enough to stream whole frames to a viewer.
+        out << "P6\n" << width << ' ' << height << "\n255\n";
+        std::vector<unsigned char> row(size_t(width) * 3);
+        for (int j = 0; j < height; j++) {
+            for (int i = 0; i < width; i++)
+                color_to_bytes(at(i, j), &row[size_t(i) * 3]);
+            out.write(reinterpret_cast<const char*>(row.data()), row.size());
+        }
+    }
+
+    bool save(const std::string& path) const {
+        std::ofstream outfile(path);
+        if (!outfile) {
+            std::cerr << "Error: Could not open " << path << " for writing.\n";
+            return false;
+        }
+        write_ppm(outfile);
+        return true;
+    }
+
+    bool save_pfm(const std::string& path) const {
+        // Little-endian float PFM (rows bottom to top), keeping linear radiance unclamped.
+        std::ofstream out(path, std::ios::binary);
+        if (!out) {
+            std::cerr << "Error: Could not open " << path << " for writing.\n";
+            return false;
+        }
+        out << "PF\n" << width << ' ' << height << "\n-1.0\n";
+        std::vector<float> row(size_t(width) * 3);
+        for (int j = height - 1; j >= 0; j--) {
+            for (int i = 0; i < width; i++)
+                for (int c = 0; c < 3; c++)
+                    row[size_t(i) * 3 + c] = float(at(i, j)[c]);
+            out.write(reinterpret_cast<const char*>(row.data()), row.size() * sizeof(float));
+        }
+        return bool(out);
+    }
+
+    bool load_pfm(const std::string& path) {
+        // Reads files written by save_pfm.
+        std::ifstream in(path, std::ios::binary);
+        std::string magic;
+        double scale;
+        int w, h;
+        if (!(in >> magic >> w >> h >> scale) || magic != "PF" || scale >= 0 || w <= 0 || h <= 0)
+            return false;
+        in.get();
+
+        *this = framebuffer(w, h);
+        std::vector<float> row(size_t(width) * 3);
+        for (int j = height - 1; j >= 0; j--) {
+            if (!in.read(reinterpret_cast<char*>(row.data()), row.size() * sizeof(float)))
+                return false;
+            for (int i = 0; i < width; i++)
+                at(i, j) = color(row[size_t(i) * 3], row[size_t(i) * 3 + 1], row[size_t(i) * 3 + 2]);
+        }
+        return true;
+    }
+};
+
+#endif
@@ -0,0 +1,102 @@
+#ifndef GBUFFER_H
+#define GBUFFER_H
+
+#include "rtweekend.h"
+#include "hittable.h"
+
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+class material;
+
+// First-hit data for one primary ray sample, packed into 48 bytes. The hit point is not
+// stored; it is center + t * direction.
+class gbuffer_sample {
+  public:
+    const hittable* object = nullptr;  // Primitive id, nullptr if the ray escaped the scene
+    const material* mat = nullptr;     // Material id
+    float    direction[3] = {0, 0, 0}; // Primary ray direction; the origin is the camera center
+    float    normal[3] = {0, 0, 0};
+    float    t = 0;                    // Hit distance, negated for a back face hit
+    uint32_t mat_revision = 0;         // Low bits of material::revision() when last shaded
+
+    vec3 ray_direction() const { return vec3(direction[0], direction[1], direction[2]); }
+    vec3 hit_normal() const { return vec3(normal[0], normal[1], normal[2]); }
+    double hit_t() const { return std::fabs(t); }
+    bool front_face() const { return t >= 0; }
+
+    void set_direction(const vec3& d) {
+        for (int a = 0; a < 3; a++)
+            direction[a] = float(d[a]);
+    }
+
+    void set_hit(const hit_record& rec) {
+        for (int a = 0; a < 3; a++)
+            normal[a] = float(rec.normal[a]);
+        t = float(rec.front_face ? rec.t : -rec.t);
+        object = rec.object;
+        mat = rec.mat.get();
+    }
+};
+
+// Cache of primary hits filled by camera::render(world, cache). A later render with the same
+// camera settings skips primary intersection and only re-shades pixels whose first-hit
+// material has been edited since; every other pixel keeps its accumulated radiance.
+// Call clear() after changing geometry or swapping a primitive's material object.
+//
+// Indirect light reflected off an edited material onto other pixels is not updated.
+class gbuffer {
+  public:
+    int    width = 0;
+    int    height = 0;
+    int    samples_per_pixel = 0;
+    int    max_depth = 0;
+    point3 center;
+    point3 pixel00_loc;
+    vec3   pixel_delta_u;
+    vec3   pixel_delta_v;
+
+    // samples_per_pixel entries per pixel, row-major: 48 bytes per sample, so about 430 MB
+    // for a 400x225 image at 100 spp.
+    std::vector<gbuffer_sample> samples;
+    std::vector<color> radiance;          // Summed sample radiance per pixel
+
+    bool empty() const { return samples.empty(); }
+
+    void clear() {
+        samples.clear();
+        radiance.clear();
+    }
+
+    bool matches(int w, int h, int spp, int depth,
+                 const point3& c, const point3& p00, const vec3& du, const vec3& dv) const {
+        return !empty() && width == w && height == h && samples_per_pixel == spp && max_depth == depth
+            && same(center, c) && same(pixel00_loc, p00) && same(pixel_delta_u, du) && same(pixel_delta_v, dv);
+    }
+
+    void reset(int w, int h, int spp, int depth,
+               const point3& c, const point3& p00, const vec3& du, const vec3& dv) {
+        width = w;
+        height = h;
+        samples_per_pixel = spp;
+        max_depth = depth;
+        center = c;
+        pixel00_loc = p00;
+        pixel_delta_u = du;
+        pixel_delta_v = dv;
+        samples.assign(size_t(w) * h * spp, gbuffer_sample());
+        radiance.assign(size_t(w) * h, color(0,0,0));
+    }
+
+    gbuffer_sample* pixel_samples(int i, int j) {
+        return &samples[(size_t(j) * width + i) * samples_per_pixel];
+    }
+
+  private:
+    static bool same(const vec3& a, const vec3& b) {
+        return a.x() == b.x() && a.y() == b.y() && a.z() == b.z();
+    }
+};
+
+#endif
@@ -8,12 +8,14 @@
 
 
 class material;
+class hittable;
 
 class hit_record {
   public:
     point3 p;
     vec3 normal;
     shared_ptr<material> mat;
+    const hittable* object = nullptr;  // Primitive that was hit
     double t;
     bool front_face;
 
@@ -33,6 +35,10 @@ class hittable {
     //virtual bool hit(const ray& r, double ray_tmin, double ray_tmax, hit_record& rec) const = 0;
     
     virtual bool hit(const ray& r, interval ray_t, hit_record& rec) const = 0;
+
+    // Any-hit query: true as soon as anything blocks the ray inside ray_t. Cheaper than hit()
+    // for shadow and visibility rays because it never looks for the nearest hit.
+    virtual bool occluded(const ray& r, interval ray_t) const = 0;
     virtual bool bounding_box(double time0, double time1, aabb& output_box) const = 0;
   };
 
@@ -43,6 +43,19 @@ class hittable_list : public hittable {
 
         return hit_anything;
     }
+    bool occluded(const ray& r, interval ray_t) const override {
+        for (const auto& object : objects) {
+            aabb box;
+            if (!object->bounding_box(0, 0, box) || !box.hit(r, ray_t.min, ray_t.max))
+                continue;
+
+            if (object->occluded(r, ray_t))
+                return true;
+        }
+
+        return false;
+    }
+
     bool bounding_box(double time0, double time1, aabb& output_box) const override {
         if (objects.empty()) return false;
 
@@ -11,41 +11,29 @@
 #include "material.h"
 #include "checker_texture.h"
 #include "plane.h"
+#include "bvh.h"
+#include "scenes.h"
+#include "thread_pool.h"
 
 #include <fstream>
 #include <iostream>
+#include <string>
+#include <vector>
 
 
 int main() {
     hittable_list world;
 
     bool antialiasing = true; //turn on or off antialiasing
+    bool preview = false; //time-budgeted progressive preview instead of the full render
+    bool ambient_occlusion = false; //render an ambient occlusion image instead of the full render
+    bool turntable = false; //render a batch of views circling the scene to output_0.ppm, output_1.ppm, ...
+    bool banded = false; //stream a binary output.ppm band by band, memory stays bounded for huge images
+    bool out_of_core = false; //render a large generated scene paged from scene_clusters.bin instead
 
-    //floor
-    auto ground_material = make_shared<checker_texture>(
-        color(0.2, 0.8, 0.2),  // green
-        color(1, 1, 1),  // white
-        20.0            // higher frequency = smaller checks
-    );
+    build_main_scene(world);
 
-    world.add(make_shared<plane>(point3(0, -0.5, -1.5), vec3(0, 1, 0), ground_material));
-
-
-    //sphere
-    auto checker_sphere_mat = make_shared<checker_texture>(
-        color(1, 0, 0),  // red
-        color(1, 1, 1),  // white
-        20.0            // higher frequency = smaller checks
-    );
-
-    world.add(make_shared<sphere>(point3(1.0, 0.1, -1.0), 0.5, checker_sphere_mat));
-
-
-    auto material_center = make_shared<lambertian>(color(0.1, 0.2, 0.5)); //matt colour
-    auto material_left   = make_shared<metal>(color(0.8, 0.8, 0.8)); //reflective metal
-    
-    world.add(make_shared<sphere>(point3( 0.0,    0.0, -1.2),   0.5, material_center));
-    world.add(make_shared<sphere>(point3(-1.0,    0.0, -1.0),   0.5, material_left));
+    bvh scene(world, "scene.bvh"); //reused on later runs while the scene is unchanged
 
     camera cam;
 
@@ -61,5 +49,61 @@ int main() {
 
     cam.max_depth = 50;
 
-    cam.render(world);
+    if(preview == true){
+        cam.preview_time_budget = 2.0; //seconds
+        cam.render_preview(scene);
+    }
+    else if(ambient_occlusion == true){
+        cam.render_ambient_occlusion(scene);
+    }
+    else if(out_of_core == true){
+        const size_t sphere_count = 2000000;
+        const size_t cache_bytes = size_t(64) << 20; //cluster cache cap
+
+        //regenerate unless the file holds this scene, streaming the spheres so they never all sit in memory
+        std::ifstream existing("scene_clusters.bin", std::ios::binary);
+        cluster_file_header header;
+        if (!read_cluster_header(existing, header) || header.record_count != sphere_count) {
+            existing.close();
+            write_clusters("scene_clusters.bin", [&](const std::function<void(const sphere_record&)>& emit) {
+                for_each_random_sphere(sphere_count, 1, emit);
+            });
+        }
+
+        hittable_list big_world;
+        add_ground(big_world);
+        auto paged = make_shared<paged_scene>("scene_clusters.bin", cache_bytes);
+        big_world.add(paged);
+
+        thread_pool pool;
+        cam.render_framebuffer(big_world, pool).save("output.ppm");
+        paged->print_stats(std::clog);
+    }
+    else if(banded == true){
+        thread_pool pool;
+        cam.render_banded(scene, "output.ppm", pool);
+    }
+    else if(turntable == true){
+        const int view_count = 8;
+        const point3 target(0, 0, -1.2);
+        const double radius = 2.5;
+
+        std::vector<camera> views;
+        for (int k = 0; k < view_count; k++) {
+            camera view = cam;
+            double angle = 2 * pi * k / view_count;
+            view.lookfrom = target + vec3(radius * std::sin(angle), 0.5, radius * std::cos(angle));
+            view.lookat   = target;
+            view.vfov     = 50;
+            views.push_back(view);
+        }
+
+        thread_pool pool;
+        auto frames = camera::render_batch(views, scene, pool);
+        for (size_t k = 0; k < frames.size(); k++)
+            frames[k].save("output_" + std::to_string(k) + ".ppm");
+    }
+    else{
+        cam.render(scene);
+    }
 }
\ No newline at end of file
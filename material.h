@@ -12,12 +12,28 @@ class material {
     ) const {
         return false;
     }
+
+    // Diffuse materials scatter into a broad lobe whose incoming light may be cached.
+    virtual bool is_diffuse() const { return false; }
+
+    // Bumped by every parameter setter, so cached renders can tell which materials changed.
+    unsigned long revision() const { return rev; }
+
+  protected:
+    void touch() { rev++; }
+
+  private:
+    unsigned long rev = 0;
 };
 
 class lambertian : public material {
   public:
     lambertian(const color& albedo) : albedo(albedo) {}
 
+    void set_albedo(const color& c) { albedo = c; touch(); }
+
+    bool is_diffuse() const override { return true; }
+
     bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered)
     const override {
         auto scatter_direction = rec.normal + random_unit_vector();
@@ -39,6 +55,8 @@ class metal : public material {
   public:
     metal(const color& albedo) : albedo(albedo) {}
 
+    void set_albedo(const color& c) { albedo = c; touch(); }
+
     bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered)
     const override {
         vec3 reflected = reflect(r_in.direction(), rec.normal);
@@ -0,0 +1,539 @@
+#ifndef PAGED_SCENE_H
+#define PAGED_SCENE_H
+
+#include "rtweekend.h"
+#include "hittable.h"
+#include "hittable_list.h"
+#include "sphere.h"
+#include "material.h"
+#include "checker_texture.h"
+#include "bvh.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <future>
+#include <list>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// On-disk description of one sphere and its material.
+class sphere_record {
+  public:
+    enum kind : uint32_t { lambertian_kind = 0, checker_kind = 1, metal_kind = 2 };
+
+    double   center[3];
+    double   radius;
+    float    albedo[3];
+    uint32_t type;      // Material, one of kind
+
+    shared_ptr<material> make_material() const {
+        color c(albedo[0], albedo[1], albedo[2]);
+        switch (type) {
+            case checker_kind: return make_shared<checker_texture>(c, color(1, 1, 1), 40.0);
+            case metal_kind:   return make_shared<metal>(c);
+            default:           return make_shared<lambertian>(c);
+        }
+    }
+
+    sphere make_sphere() const {
+        return sphere(point3(center[0], center[1], center[2]), radius, make_material());
+    }
+};
+
+// Cluster file layout: header, then one cluster_info per cluster, then the sphere_records of
+// every cluster. Only the header and the cluster_info table are ever fully in memory.
+class cluster_file_header {
+  public:
+    char     magic[8];
+    uint32_t version;
+    uint32_t record_size;
+    uint64_t cluster_count;
+    uint64_t record_count;
+};
+
+class cluster_info {
+  public:
+    double   minimum[3];
+    double   maximum[3];
+    uint64_t offset;  // Byte offset of the cluster's first record
+    uint64_t count;   // Number of records
+};
+
+// Reorders records[begin, end) into spatially coherent clusters of at most cluster_size records
+// by median splits along the longest axis of the sphere centers, and returns the [begin, end)
+// range of every cluster.
+std::vector<std::pair<size_t, size_t>> split_clusters(std::vector<sphere_record>& records, size_t cluster_size) {
+    std::vector<std::pair<size_t, size_t>> ranges;
+
+    std::vector<std::pair<size_t, size_t>> pending = {{0, records.size()}};
+    while (!pending.empty()) {
+        auto [begin, end] = pending.back();
+        pending.pop_back();
+        if (end - begin <= cluster_size) {
+            if (end > begin)
+                ranges.push_back({begin, end});
+            continue;
+        }
+
+        double lo[3] = { infinity,  infinity,  infinity};
+        double hi[3] = {-infinity, -infinity, -infinity};
+        for (size_t k = begin; k < end; k++) {
+            for (int a = 0; a < 3; a++) {
+                lo[a] = std::fmin(lo[a], records[k].center[a]);
+                hi[a] = std::fmax(hi[a], records[k].center[a]);
+            }
+        }
+        int axis = 0;
+        for (int a = 1; a < 3; a++)
+            if (hi[a] - lo[a] > hi[axis] - lo[axis])
+                axis = a;
+
+        size_t mid = begin + (end - begin) / 2;
+        std::nth_element(records.begin() + begin, records.begin() + mid, records.begin() + end,
+                         [axis](const sphere_record& a, const sphere_record& b) {
+                             return a.center[axis] < b.center[axis];
+                         });
+        pending.push_back({mid, end});
+        pending.push_back({begin, mid});
+    }
+    return ranges;
+}
+
+// Number of ranges split_clusters returns for `count` records, which depends on nothing else.
+inline uint64_t split_cluster_count(uint64_t count, size_t cluster_size) {
+    if (count <= cluster_size)
+        return count > 0 ? 1 : 0;
+    return split_cluster_count(count / 2, cluster_size) + split_cluster_count(count - count / 2, cluster_size);
+}
+
+// Produces the records of a scene by calling emit once per record. Every call must produce the
+// same records in the same order, since write_clusters reads the scene twice.
+using sphere_source = std::function<void(const std::function<void(const sphere_record&)>&)>;
+
+// Reads and checks the header at the start of a cluster file.
+inline bool read_cluster_header(std::istream& in, cluster_file_header& header) {
+    return in.read(reinterpret_cast<char*>(&header), sizeof(header))
+        && std::memcmp(header.magic, "RTCLUST\0", 8) == 0 && header.version == 1
+        && header.record_size == sizeof(sphere_record);
+}
+
+// Interleaves the low 21 bits of x with two zero bits after each bit.
+inline uint64_t spread_bits(uint64_t x) {
+    x &= 0x1fffff;
+    x = (x | x << 32) & 0x1f00000000ffffull;
+    x = (x | x << 16) & 0x1f0000ff0000ffull;
+    x = (x | x << 8)  & 0x100f00f00f00f00full;
+    x = (x | x << 4)  & 0x10c30c30c30c30c3ull;
+    x = (x | x << 2)  & 0x1249249249249249ull;
+    return x;
+}
+
+// Writes the spheres of `source` to `path` in spatially coherent clusters of at most
+// cluster_size spheres.
+//
+// Memory stays bounded whatever the number of spheres. The first pass over the source only
+// measures the scene bounds; the second sorts runs of run_size records along a Morton curve
+// through the sphere centers and writes them to a temporary file. Merging the runs yields the
+// spheres in curve order, so every group of chunk_size consecutive ones is spatially compact
+// and is cut into clusters by split_clusters. Apart from the cluster table only one run (about
+// 56 bytes per record) or one chunk is held at a time.
+bool write_clusters(const std::string& path, const sphere_source& source, size_t cluster_size = 64,
+                    size_t run_size = size_t(1) << 18, size_t chunk_size = size_t(1) << 16) {
+    struct keyed_record {
+        uint64_t      key;
+        sphere_record record;
+    };
+
+    uint64_t record_count = 0;
+    double lo[3] = { infinity,  infinity,  infinity};
+    double hi[3] = {-infinity, -infinity, -infinity};
+    source([&](const sphere_record& record) {
+        record_count++;
+        for (int a = 0; a < 3; a++) {
+            lo[a] = std::fmin(lo[a], record.center[a]);
+            hi[a] = std::fmax(hi[a], record.center[a]);
+        }
+    });
+
+    auto key_of = [&](const sphere_record& record) {
+        uint64_t key = 0;
+        for (int a = 0; a < 3; a++) {
+            double extent = hi[a] - lo[a];
+            double f = extent > 0 ? std::clamp((record.center[a] - lo[a]) / extent, 0.0, 1.0) : 0.0;
+            key |= spread_bits(uint64_t(f * 0x1fffff)) << a;
+        }
+        return key;
+    };
+
+    // Sorted runs, one after another in a temporary file.
+    std::string run_path = unique_temp_path(path + ".runs");
+    std::vector<uint64_t> run_ends;  // Record index one past the end of every run
+    {
+        std::ofstream runs(run_path, std::ios::binary | std::ios::trunc);
+        if (!runs) {
+            std::cerr << "Error: Could not open " << run_path << " for writing.\n";
+            return false;
+        }
+
+        std::vector<keyed_record> run;
+        run.reserve(size_t(std::min<uint64_t>(run_size, record_count)));
+        uint64_t written = 0;
+        auto flush_run = [&]() {
+            std::sort(run.begin(), run.end(),
+                      [](const keyed_record& a, const keyed_record& b) { return a.key < b.key; });
+            runs.write(reinterpret_cast<const char*>(run.data()), run.size() * sizeof(keyed_record));
+            written += run.size();
+            run_ends.push_back(written);
+            run.clear();
+        };
+
+        source([&](const sphere_record& record) {
+            run.push_back({key_of(record), record});
+            if (run.size() == run_size)
+                flush_run();
+        });
+        if (!run.empty())
+            flush_run();
+
+        if (!runs || written != record_count) {
+            std::cerr << "Error: Could not write the sorted runs of " << path << ".\n";
+            runs.close();
+            std::remove(run_path.c_str());
+            return false;
+        }
+    }
+
+    // Merge the runs, cutting every chunk of the merged sequence into clusters.
+    std::vector<cluster_info> clusters(size_t(
+        record_count / chunk_size * split_cluster_count(chunk_size, cluster_size)
+        + split_cluster_count(record_count % chunk_size, cluster_size)));
+
+    cluster_file_header header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, "RTCLUST\0", 8);
+    header.version = 1;
+    header.record_size = sizeof(sphere_record);
+    header.cluster_count = clusters.size();
+    header.record_count = record_count;
+
+    std::string temp_path = unique_temp_path(path);
+    std::ifstream runs(run_path, std::ios::binary);
+    std::ofstream out(temp_path, std::ios::binary | std::ios::trunc);
+    if (!runs || !out) {
+        std::cerr << "Error: Could not open " << temp_path << " for writing.\n";
+        std::remove(run_path.c_str());
+        return false;
+    }
+
+    struct run_cursor {
+        uint64_t next;  // Next record index to read from the file
+        uint64_t end;
+        std::vector<keyed_record> buffer;
+        size_t position = 0;
+    };
+    const size_t buffer_records = 4096;
+    auto refill = [&](run_cursor& cursor) {
+        cursor.buffer.resize(size_t(std::min<uint64_t>(buffer_records, cursor.end - cursor.next)));
+        runs.seekg(std::streamoff(cursor.next * sizeof(keyed_record)));
+        runs.read(reinterpret_cast<char*>(cursor.buffer.data()), cursor.buffer.size() * sizeof(keyed_record));
+        cursor.next += cursor.buffer.size();
+        cursor.position = 0;
+    };
+
+    std::vector<run_cursor> cursors;
+    using heap_entry = std::pair<uint64_t, size_t>;  // Key of a run's next record, run index
+    std::priority_queue<heap_entry, std::vector<heap_entry>, std::greater<heap_entry>> heap;
+    for (size_t k = 0; k < run_ends.size(); k++) {
+        cursors.push_back({k == 0 ? 0 : run_ends[k - 1], run_ends[k], {}});
+        refill(cursors.back());
+        heap.push({cursors.back().buffer[0].key, k});
+    }
+
+    uint64_t offset = sizeof(header) + clusters.size() * sizeof(cluster_info);
+    out.seekp(std::streamoff(offset));
+    uint64_t merged = 0;
+    size_t cluster_index = 0;
+
+    std::vector<sphere_record> chunk;
+    chunk.reserve(size_t(std::min<uint64_t>(chunk_size, record_count)));
+    auto flush_chunk = [&]() {
+        for (const auto& range : split_clusters(chunk, cluster_size)) {
+            auto& info = clusters[cluster_index++];
+            for (int a = 0; a < 3; a++) {
+                info.minimum[a] =  infinity;
+                info.maximum[a] = -infinity;
+            }
+            for (size_t k = range.first; k < range.second; k++) {
+                for (int a = 0; a < 3; a++) {
+                    info.minimum[a] = std::fmin(info.minimum[a], chunk[k].center[a] - chunk[k].radius);
+                    info.maximum[a] = std::fmax(info.maximum[a], chunk[k].center[a] + chunk[k].radius);
+                }
+            }
+            info.offset = offset;
+            info.count = range.second - range.first;
+            offset += info.count * sizeof(sphere_record);
+            out.write(reinterpret_cast<const char*>(&chunk[range.first]), info.count * sizeof(sphere_record));
+        }
+        chunk.clear();
+    };
+
+    while (!heap.empty()) {
+        auto& cursor = cursors[heap.top().second];
+        heap.pop();
+        chunk.push_back(cursor.buffer[cursor.position++].record);
+        merged++;
+        if (chunk.size() == chunk_size)
+            flush_chunk();
+
+        if (cursor.position == cursor.buffer.size() && cursor.next < cursor.end)
+            refill(cursor);
+        if (cursor.position < cursor.buffer.size())
+            heap.push({cursor.buffer[cursor.position].key, size_t(&cursor - cursors.data())});
+    }
+    if (!chunk.empty())
+        flush_chunk();
+
+    out.seekp(0);
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char*>(clusters.data()), clusters.size() * sizeof(cluster_info));
+    bool ok = runs && out && merged == record_count && cluster_index == clusters.size();
+    runs.close();
+    out.close();
+    std::remove(run_path.c_str());
+    if (!ok) {
+        std::cerr << "Error: Could not write " << path << ".\n";
+        std::remove(temp_path.c_str());
+        return false;
+    }
+
+#ifdef _WIN32
+    std::remove(path.c_str());
+#endif
+    return std::rename(temp_path.c_str(), path.c_str()) == 0;
+}
+
+// Sphere geometry paged in from a cluster file on demand. Only the cluster bounds (and a BVH
+// over them) stay in memory; clusters a ray actually reaches are loaded into an LRU cache whose
+// size is capped at memory_cap bytes.
+//
+// Loads happen outside the cache lock, so other threads keep tracing resident clusters. A ray
+// that needs a cluster already being loaded by another thread waits for that load instead of
+// reading the cluster a second time.
+class paged_scene : public hittable {
+  public:
+    paged_scene(const std::string& path, size_t memory_cap) : path(path), memory_cap(memory_cap) {
+        std::ifstream in(path, std::ios::binary);
+        cluster_file_header header;
+        if (!read_cluster_header(in, header)) {
+            std::cerr << "Error: " << path << " is not a cluster file.\n";
+            return;
+        }
+
+        clusters.resize(size_t(header.cluster_count));
+        if (!in.read(reinterpret_cast<char*>(clusters.data()), clusters.size() * sizeof(cluster_info))) {
+            std::cerr << "Error: Could not read the cluster table of " << path << ".\n";
+            clusters.clear();
+            return;
+        }
+
+        hittable_list proxies;
+        for (size_t k = 0; k < clusters.size(); k++)
+            proxies.add(make_shared<cluster_proxy>(*this, uint32_t(k)));
+        top = std::make_unique<bvh>(proxies);
+    }
+
+    paged_scene(const paged_scene&) = delete;
+    paged_scene& operator=(const paged_scene&) = delete;
+
+    bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+        return top && top->hit(r, ray_t, rec);
+    }
+
+    bool occluded(const ray& r, interval ray_t) const override {
+        return top && top->occluded(r, ray_t);
+    }
+
+    bool bounding_box(double time0, double time1, aabb& output_box) const override {
+        return top && top->bounding_box(time0, time1, output_box);
+    }
+
+    void print_stats(std::ostream& out) const {
+        std::lock_guard<std::mutex> lock(cache_mutex);
+        uint64_t requests = stats.hits + stats.misses + stats.waits;
+        out << "Cluster cache: " << clusters.size() << " clusters, " << requests << " requests, "
+            << stats.hits << " hits (" << (requests ? 100.0 * stats.hits / requests : 0.0) << "%), "
+            << stats.misses << " loads, " << stats.waits << " waits on in-flight loads, "
+            << stats.evictions << " evictions, " << stats.failed_loads << " failed loads, peak resident " << stats.peak_bytes / (1024.0 * 1024.0)
+            << " MB of " << memory_cap / (1024.0 * 1024.0) << " MB\n";
+    }
+
+  private:
+    struct resident_cluster {
+        std::vector<sphere> spheres;
+        size_t bytes = 0;
+    };
+    using cluster_ptr = shared_ptr<const resident_cluster>;
+
+    struct cache_entry {
+        cluster_ptr cluster;
+        std::list<uint32_t>::iterator position;
+    };
+
+    struct cache_stats {
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        uint64_t waits = 0;
+        uint64_t evictions = 0;
+        uint64_t failed_loads = 0;
+        size_t   peak_bytes = 0;
+    };
+
+    // Leaf of the top-level BVH: tests the cluster bounds and only then pages the cluster in.
+    class cluster_proxy : public hittable {
+      public:
+        cluster_proxy(const paged_scene& owner, uint32_t index) : owner(owner), index(index) {
+            const auto& info = owner.clusters[index];
+            box = aabb(point3(info.minimum[0], info.minimum[1], info.minimum[2]),
+                       point3(info.maximum[0], info.maximum[1], info.maximum[2]));
+        }
+
+        bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+            if (!box.hit(r, ray_t.min, ray_t.max))
+                return false;
+
+            auto cluster = owner.fetch(index);
+            bool hit_anything = false;
+            for (const auto& s : cluster->spheres) {
+                if (s.hit(r, ray_t, rec)) {
+                    hit_anything = true;
+                    ray_t.max = rec.t;
+                }
+            }
+            return hit_anything;
+        }
+
+        bool occluded(const ray& r, interval ray_t) const override {
+            if (!box.hit(r, ray_t.min, ray_t.max))
+                return false;
+
+            auto cluster = owner.fetch(index);
+            for (const auto& s : cluster->spheres)
+                if (s.occluded(r, ray_t))
+                    return true;
+            return false;
+        }
+
+        bool bounding_box(double time0, double time1, aabb& output_box) const override {
+            output_box = box;
+            return true;
+        }
+
+      private:
+        const paged_scene& owner;
+        uint32_t index;
+        aabb box;
+    };
+
+    std::string path;
+    size_t memory_cap;
+    std::vector<cluster_info> clusters;
+    std::unique_ptr<bvh> top;
+
+    mutable std::mutex cache_mutex;
+    mutable std::list<uint32_t> lru;  // Most recently used first
+    mutable std::unordered_map<uint32_t, cache_entry> resident;
+    mutable std::unordered_map<uint32_t, std::shared_future<cluster_ptr>> loading;
+    mutable size_t resident_bytes = 0;
+    mutable cache_stats stats;
+
+    cluster_ptr fetch(uint32_t index) const {
+        std::promise<cluster_ptr> loaded;
+        std::unique_lock<std::mutex> lock(cache_mutex);
+
+        auto found = resident.find(index);
+        if (found != resident.end()) {
+            stats.hits++;
+            lru.splice(lru.begin(), lru, found->second.position);
+            return found->second.cluster;
+        }
+
+        auto in_flight = loading.find(index);
+        if (in_flight != loading.end()) {
+            stats.waits++;
+            auto pending = in_flight->second;
+            lock.unlock();
+            return pending.get();
+        }
+
+        stats.misses++;
+        loading[index] = loaded.get_future().share();
+        lock.unlock();
+
+        cluster_ptr cluster = load(index);
+
+        lock.lock();
+        if (!cluster) {
+            // Not cached, so the next ray that reaches this cluster tries to read it again.
+            // Rays already waiting on this load see no geometry this time.
+            if (stats.failed_loads++ == 0)
+                std::cerr << "Error: Could not read cluster " << index << " of " << path
+                          << "; further failures are only counted in the cache stats.\n";
+            loading.erase(index);
+            lock.unlock();
+            cluster = std::make_shared<resident_cluster>();
+            loaded.set_value(cluster);
+            return cluster;
+        }
+        lru.push_front(index);
+        resident[index] = {cluster, lru.begin()};
+        resident_bytes += cluster->bytes;
+        stats.peak_bytes = std::max(stats.peak_bytes, resident_bytes);
+
+        // Evicted clusters stay alive while a ray is still using them.
+        while (resident_bytes > memory_cap && lru.size() > 1) {
+            uint32_t victim = lru.back();
+            lru.pop_back();
+            resident_bytes -= resident[victim].cluster->bytes;
+            resident.erase(victim);
+            stats.evictions++;
+        }
+        loading.erase(index);
+        lock.unlock();
+
+        loaded.set_value(cluster);
+        return cluster;
+    }
+
+    cluster_ptr load(uint32_t index) const {
+        // Returns nullptr if the cluster could not be read.
+        auto cluster = std::make_shared<resident_cluster>();
+        const auto& info = clusters[index];
+
+        std::vector<sphere_record> records(size_t(info.count));
+        std::ifstream in(path, std::ios::binary);
+        in.seekg(std::streamoff(info.offset));
+        if (!in.read(reinterpret_cast<char*>(records.data()), records.size() * sizeof(sphere_record))) {
+            return nullptr;
+        }
+
+        cluster->spheres.reserve(records.size());
+        for (const auto& record : records) {
+            cluster->spheres.push_back(record.make_sphere());
+            // The sphere plus its material allocation, including make_shared's control block.
+            cluster->bytes += sizeof(sphere) + 16 + (record.type == sphere_record::checker_kind
+                                                       ? sizeof(checker_texture)
+                                                       : record.type == sphere_record::metal_kind
+                                                             ? sizeof(metal) : sizeof(lambertian));
+        }
+        cluster->bytes += sizeof(resident_cluster);
+        return cluster;
+    }
+};
+
+#endif
@@ -28,9 +28,18 @@ class plane : public hittable {
         rec.p = r.at(t);
         rec.set_face_normal(r, normal);
         rec.mat = mat;
+        rec.object = this;
         return true;
     }
 
+    bool occluded(const ray& r, interval ray_t) const override {
+        double denom = dot(normal, r.direction());
+        if (fabs(denom) < 1e-8)
+            return false;
+
+        return ray_t.surrounds(dot(point - r.origin(), normal) / denom);
+    }
+
     bool bounding_box(double time0, double time1, aabb& output_box) const override {
     output_box = aabb(
         point3(-1e5, point.y() - 0.001, -1e5),
@@ -0,0 +1,124 @@
+#ifndef RADIANCE_CACHE_H
+#define RADIANCE_CACHE_H
+
+#include "rtweekend.h"
+
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+// Hashed cache of incoming radiance at diffuse surfaces. Space is cut into cubic cells and
+// each cell is split by the dominant axis of the surface normal; an entry holds the mean
+// radiance arriving along the material's scatter directions. camera fills it during its first
+// samples and later substitutes it for deep diffuse bounces.
+//
+// The table has a fixed number of entries allocated up front, so memory stays capped: once a
+// probe sequence is full new cells are dropped rather than added. record() and lookup() may
+// be called from any number of threads.
+class radiance_cache {
+  public:
+    radiance_cache(double cell_size = 0.05, size_t max_entries = size_t(1) << 20, int min_samples = 4)
+      : inv_cell_size(1.0 / cell_size), min_samples(min_samples), entries(round_up_pow2(max_entries)) {}
+
+    void record(const point3& p, const vec3& normal, const color& radiance) {
+        uint64_t key = key_of(p, normal);
+        for (size_t probe = 0, slot = slot_of(key); probe < max_probes; probe++, slot = next(slot)) {
+            std::lock_guard<std::mutex> lock(stripe_of(slot));
+            auto& e = entries[slot];
+            if (e.key == 0)
+                e.key = key;
+            else if (e.key != key)
+                continue;
+
+            for (int c = 0; c < 3; c++)
+                e.sum[c] += float(radiance[c]);
+            e.count++;
+            return;
+        }
+        dropped++;
+    }
+
+    bool lookup(const point3& p, const vec3& normal, color& radiance) const {
+        // True, with the cell's mean radiance, once the cell holds at least min_samples.
+        lookups++;
+        uint64_t key = key_of(p, normal);
+        for (size_t probe = 0, slot = slot_of(key); probe < max_probes; probe++, slot = next(slot)) {
+            std::lock_guard<std::mutex> lock(stripe_of(slot));
+            const auto& e = entries[slot];
+            if (e.key == 0)
+                return false;
+            if (e.key != key)
+                continue;
+            if (e.count < uint32_t(min_samples))
+                return false;
+
+            radiance = color(e.sum[0], e.sum[1], e.sum[2]) / e.count;
+            hits++;
+            return true;
+        }
+        return false;
+    }
+
+    void clear() {
+        for (auto& e : entries)
+            e = entry();
+    }
+
+    size_t memory_bytes() const { return entries.size() * sizeof(entry) + sizeof(*this); }
+
+    double hit_rate() const {
+        return lookups ? double(hits) / double(lookups) : 0.0;
+    }
+
+    size_t dropped_records() const { return dropped; }
+
+  private:
+    struct entry {
+        uint64_t key = 0;  // 0 marks an empty slot
+        float    sum[3] = {0, 0, 0};
+        uint32_t count = 0;
+    };
+
+    static constexpr size_t max_probes = 8;
+    static constexpr size_t stripe_count = 256;
+
+    double inv_cell_size;
+    int    min_samples;
+    std::vector<entry> entries;
+    mutable std::mutex stripes[stripe_count];
+
+    mutable std::atomic<uint64_t> lookups{0};
+    mutable std::atomic<uint64_t> hits{0};
+    std::atomic<uint64_t> dropped{0};
+
+    static size_t round_up_pow2(size_t n) {
+        size_t size = 1;
+        while (size < n)
+            size <<= 1;
+        return size;
+    }
+
+    uint64_t key_of(const point3& p, const vec3& normal) const {
+        int axis = 0;
+        for (int a = 1; a < 3; a++)
+            if (std::fabs(normal[a]) > std::fabs(normal[axis]))
+                axis = a;
+        uint64_t direction = uint64_t(2 * axis + (normal[axis] < 0 ? 1 : 0));
+
+        uint64_t key = 1469598103934665603ull;
+        for (int a = 0; a < 3; a++) {
+            auto cell = int64_t(std::floor(p[a] * inv_cell_size));
+            key = (key ^ uint64_t(cell)) * 1099511628211ull;
+        }
+        key = (key ^ direction) * 1099511628211ull;
+        return key ? key : 1;
+    }
+
+    size_t slot_of(uint64_t key) const { return size_t(key ^ (key >> 29)) & (entries.size() - 1); }
+    size_t next(size_t slot) const { return (slot + 1) & (entries.size() - 1); }
+    std::mutex& stripe_of(size_t slot) const { return stripes[slot % stripe_count]; }
+};
+
+#endif
@@ -0,0 +1,31 @@
+// Persistent render service: loads the scenes once, then renders jobs sent over a Unix socket
+// until stopped. See render_service.h for the request format.
+//
+// Usage: render_service [socket path] [render threads] [connection handlers]
+#include "rtweekend.h"
+#include "render_service.h"
+#include "scenes.h"
+
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <thread>
+
+int main(int argc, char** argv) {
+#ifdef _WIN32
+    std::cerr << "render_service needs Unix domain sockets and is not available on Windows.\n";
+    return 1;
+#else
+    std::string socket_path = argc > 1 ? argv[1] : "/tmp/raytracer.sock";
+    unsigned threads = argc > 2 ? unsigned(std::atoi(argv[2])) : std::thread::hardware_concurrency();
+
+    unsigned handlers = argc > 3 ? unsigned(std::atoi(argv[3])) : 4;
+
+    render_service service(threads, handlers);
+    service.add_scene("main",        [](hittable_list& world) { build_main_scene(world); });
+    service.add_scene("random_200",  [](hittable_list& world) { build_random_scene(world, 200); });
+    service.add_scene("random_2000", [](hittable_list& world) { build_random_scene(world, 2000); });
+
+    return service.serve(socket_path) ? 0 : 1;
+#endif
+}
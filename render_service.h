@@ -0,0 +1,317 @@
+#ifndef RENDER_SERVICE_H
+#define RENDER_SERVICE_H
+
+#include "rtweekend.h"
+#include "camera.h"
+#include "framebuffer.h"
+#include "hittable_list.h"
+#include "bvh.h"
+#include "thread_pool.h"
+
+#include <atomic>
+#include <chrono>
+#include <cerrno>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <functional>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifndef _WIN32
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0  // Platforms without it raise SIGPIPE on a closed client instead
+#endif
+#endif
+
+// Long-running renderer that keeps its scenes (and their BVHs) in memory and answers render
+// jobs on a Unix domain socket.
+//
+// A client connects, sends one job as a single line of key=value pairs and reads back either a
+// binary PPM of the requested region or a line starting with "ERR". For example:
+//
+//     scene=main width=400 aspect=1.7778 spp=10 depth=50 lookfrom=0,0,0 lookat=0,0,-1 vfov=90 region=0,0,200,100
+//
+// Every key is optional except scene; the others default to camera's defaults, and region to
+// the whole image. Jobs larger than max_pixels, jobs whose region times spp exceeds
+// max_samples, degenerate camera frames and out of range values are refused with ERR.
+//
+// Accepted connections wait in a queue of at most max_queued jobs, which a fixed set of
+// handler threads works through; a connection arriving while the queue is full is answered
+// "ERR busy" at once. A client has request_timeout to send its request line. The tracing for
+// every job is queued as tiles on one shared thread pool.
+class render_service {
+  public:
+    static constexpr long long max_pixels = 1LL << 24;   // Largest full image a job may ask for
+    static constexpr long long max_samples = 1LL << 28;  // Most pixel samples a job may trace
+    static constexpr int       max_dimension = 16384;
+    static constexpr std::chrono::seconds request_timeout{10};
+    static constexpr std::chrono::seconds send_timeout{60};
+
+    explicit render_service(unsigned threads = std::thread::hardware_concurrency(), unsigned handlers = 4,
+                            size_t max_queued = 64)
+      : pool(threads), handler_pool(handlers), max_queued(max_queued) {}
+
+    void add_scene(const std::string& name, const std::function<void(hittable_list&)>& build) {
+        auto entry = std::make_shared<loaded_scene>();
+        build(entry->objects);
+        entry->world = std::make_unique<bvh>(entry->objects);
+        scenes[name] = entry;
+        std::clog << "Loaded scene " << name << " (" << entry->objects.objects.size() << " objects)\n";
+    }
+
+    bool render_job(const std::string& request, framebuffer& image, std::string& error) {
+        // Parses and renders one job. Safe to call from several threads at once.
+        std::istringstream fields(request);
+        std::string field;
+        std::map<std::string, std::string> job;
+        while (fields >> field) {
+            auto eq = field.find('=');
+            if (eq == std::string::npos) {
+                error = "malformed field " + field;
+                return false;
+            }
+            job[field.substr(0, eq)] = field.substr(eq + 1);
+        }
+
+        auto found = scenes.find(job["scene"]);
+        if (found == scenes.end()) {
+            error = "unknown scene " + job["scene"];
+            return false;
+        }
+
+        camera cam;
+        int region[4] = {0, 0, -1, -1};
+        for (const auto& [key, value] : job) {
+            bool ok = true;
+            if (key == "scene") continue;
+            else if (key == "width") ok = parse_int(value, 1, max_dimension, cam.image_width);
+            else if (key == "aspect") ok = parse_double(value, cam.aspect_ratio) && cam.aspect_ratio > 0;
+            else if (key == "spp") ok = parse_int(value, 1, 100000, cam.samples_per_pixel);
+            else if (key == "depth") ok = parse_int(value, 1, 1000, cam.max_depth);
+            else if (key == "vfov") ok = parse_double(value, cam.vfov) && cam.vfov > 0 && cam.vfov < 180;
+            else if (key == "lookfrom") ok = parse_vec3(value, cam.lookfrom);
+            else if (key == "lookat") ok = parse_vec3(value, cam.lookat);
+            else if (key == "vup") ok = parse_vec3(value, cam.vup);
+            else if (key == "region") ok = parse_region(value, region);
+            else ok = false;
+
+            if (!ok) {
+                error = "bad value for " + key + ": " + value;
+                return false;
+            }
+        }
+
+        // camera derives the height as int(width / aspect), so it is checked here first.
+        double height = std::max(1.0, std::floor(cam.image_width / cam.aspect_ratio));
+        if (height > max_dimension || cam.image_width * height > double(max_pixels)) {
+            error = "image too large: at most " + std::to_string(max_dimension) + " pixels per side and "
+                  + std::to_string(max_pixels) + " pixels in total";
+            return false;
+        }
+
+        // Bounds the tracing a single job can queue on the shared pool.
+        double region_w = std::min<double>(region[2] < 0 ? cam.image_width : region[2], cam.image_width) - region[0];
+        double region_h = std::min<double>(region[3] < 0 ? height : region[3], height) - region[1];
+        if (std::max(region_w, 0.0) * std::max(region_h, 0.0) * cam.samples_per_pixel > double(max_samples)) {
+            error = "too much work: region pixels times spp must be at most " + std::to_string(max_samples);
+            return false;
+        }
+
+        vec3 view = cam.lookfrom - cam.lookat;
+        if (view.length_squared() == 0) {
+            error = "lookfrom and lookat are the same point";
+            return false;
+        }
+        if (cross(cam.vup, unit_vector(view)).length_squared() <= 1e-12 * cam.vup.length_squared()) {
+            error = "vup is zero or parallel to the view direction";
+            return false;
+        }
+
+        image = cam.render_framebuffer(*found->second->world, pool, region[0], region[1], region[2], region[3]);
+        if (image.pixels.empty()) {
+            error = "empty region";
+            return false;
+        }
+        return true;
+    }
+
+#ifndef _WIN32
+    bool serve(const std::string& socket_path) {
+        // Accepts connections until the process is stopped.
+        int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (listener < 0) {
+            std::cerr << "Error: Could not create socket.\n";
+            return false;
+        }
+
+        sockaddr_un address{};
+        address.sun_family = AF_UNIX;
+        if (socket_path.size() >= sizeof(address.sun_path)) {
+            std::cerr << "Error: Socket path too long: " << socket_path << '\n';
+            ::close(listener);
+            return false;
+        }
+        socket_path.copy(address.sun_path, socket_path.size());
+        unlink(socket_path.c_str());
+
+        if (bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0
+            || listen(listener, 64) != 0) {
+            std::cerr << "Error: Could not listen on " << socket_path << '\n';
+            ::close(listener);
+            return false;
+        }
+        std::clog << "Listening on " << socket_path << " with " << handler_pool.size() << " handlers and "
+                  << pool.size() << " render threads\n";
+
+        while (true) {
+            int client = accept(listener, nullptr, nullptr);
+            if (client < 0) {
+                if (errno == EINTR || errno == ECONNABORTED)
+                    continue;
+                if (errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM) {
+                    // Out of descriptors or memory until some connections close; wait rather than spin.
+                    std::cerr << "Warning: accept failed: " << std::strerror(errno) << '\n';
+                    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+                    continue;
+                }
+                std::cerr << "Error: accept failed: " << std::strerror(errno) << '\n';
+                ::close(listener);
+                return false;
+            }
+            set_timeout(client, SO_RCVTIMEO, request_timeout);
+            set_timeout(client, SO_SNDTIMEO, send_timeout);
+
+            if (queued.fetch_add(1) >= max_queued) {
+                queued--;
+                reply(client, "ERR busy\n");
+                continue;
+            }
+            handler_pool.submit([this, client] {
+                handle(client);
+                queued--;
+            });
+        }
+    }
+#endif
+
+  private:
+    struct loaded_scene {
+        hittable_list objects;
+        std::unique_ptr<bvh> world;
+    };
+
+    thread_pool pool;          // Traces the tiles of every job
+    thread_pool handler_pool;  // Reads requests and sends responses, one connection per thread
+    size_t max_queued;
+    std::atomic<size_t> queued{0};  // Connections waiting for or held by a handler
+    std::map<std::string, std::shared_ptr<loaded_scene>> scenes;  // Only modified before serving
+
+    static bool parse_int(const std::string& text, int minimum, int maximum, int& out) {
+        char* end;
+        long value = std::strtol(text.c_str(), &end, 10);
+        if (end == text.c_str() || *end != '\0' || value < minimum || value > maximum)
+            return false;
+        out = int(value);
+        return true;
+    }
+
+    static bool parse_double(const std::string& text, double& out) {
+        char* end;
+        out = std::strtod(text.c_str(), &end);
+        return end != text.c_str() && *end == '\0' && std::isfinite(out);
+    }
+
+    static bool parse_list(const std::string& text, int count, double* out) {
+        std::istringstream items(text);
+        std::string item;
+        int k = 0;
+        while (std::getline(items, item, ',')) {
+            if (k == count || !parse_double(item, out[k]))
+                return false;
+            k++;
+        }
+        return k == count;
+    }
+
+    static bool parse_vec3(const std::string& text, vec3& out) {
+        return parse_list(text, 3, out.e);
+    }
+
+    static bool parse_region(const std::string& text, int region[4]) {
+        double values[4];
+        if (!parse_list(text, 4, values))
+            return false;
+        // Negative x1 or y1 mean the right or bottom edge; anything beyond the image is clamped.
+        for (int k = 0; k < 4; k++) {
+            if (values[k] < (k < 2 ? 0 : -1) || values[k] > max_dimension)
+                return false;
+            region[k] = int(values[k]);
+        }
+        return true;
+    }
+
+#ifndef _WIN32
+    static void set_timeout(int socket, int option, std::chrono::seconds timeout) {
+        timeval tv{};
+        tv.tv_sec = time_t(timeout.count());
+        setsockopt(socket, SOL_SOCKET, option, &tv, sizeof(tv));
+    }
+
+    void handle(int client) {
+        // SO_RCVTIMEO bounds each read; the deadline bounds a client trickling in bytes.
+        auto deadline = std::chrono::steady_clock::now() + request_timeout;
+        std::string request;
+        bool complete = false;
+        while (request.size() < 4096 && std::chrono::steady_clock::now() < deadline) {
+            char c;
+            ssize_t n = read(client, &c, 1);
+            if (n <= 0 || c == '\n') {
+                complete = n >= 0;  // A newline or the end of the stream; not a timeout
+                break;
+            }
+            request += c;
+        }
+
+        std::ostringstream response;
+        try {
+            framebuffer image;
+            std::string error;
+            if (!complete)
+                response << "ERR incomplete request\n";
+            else if (render_job(request, image, error))
+                image.write_binary_ppm(response);
+            else
+                response << "ERR " << error << '\n';
+        } catch (const std::exception& e) {
+            response.str("");
+            response << "ERR " << e.what() << '\n';
+        }
+        reply(client, response.str());
+    }
+
+    static void reply(int client, const std::string& bytes) {
+        // Sends `bytes` and closes the connection.
+        size_t sent = 0;
+        while (sent < bytes.size()) {
+            ssize_t n = send(client, bytes.data() + sent, bytes.size() - sent, MSG_NOSIGNAL);
+            if (n <= 0)
+                break;
+            sent += size_t(n);
+        }
+        ::close(client);
+    }
+#endif
+};
+
+#endif
@@ -1,6 +1,7 @@
 #ifndef RTWEEKEND_H
 #define RTWEEKEND_H
 
+#include <atomic>
 #include <cmath>
 #include <iostream>
 #include <limits>
@@ -27,10 +28,23 @@ inline double degrees_to_radians(double degrees) {
     return degrees * pi / 180.0;
 }
 
+inline std::mt19937& random_generator() {
+    // One generator per thread, each on its own sequence. The first thread to ask gets the
+    // default mt19937 sequence, so single-threaded renders are unchanged.
+    static std::atomic<unsigned> next_stream{0};
+    thread_local std::mt19937 generator(std::mt19937::default_seed + next_stream++);
+    return generator;
+}
+
+inline void seed_random(unsigned seed) {
+    // Restarts the calling thread's random_double() sequence, e.g. to keep two renders of a
+    // scene uncorrelated.
+    random_generator().seed(seed);
+}
+
 inline double random_double() {
-    static std::uniform_real_distribution<double> distribution(0.0, 1.0);
-    static std::mt19937 generator;
-    return distribution(generator);
+    thread_local std::uniform_real_distribution<double> distribution(0.0, 1.0);
+    return distribution(random_generator());
 }
 
 inline double random_double(double min, double max) {
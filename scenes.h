@@ -0,0 +1,96 @@
+#ifndef SCENES_H
+#define SCENES_H
+
+#include "rtweekend.h"
+#include "hittable_list.h"
+#include "sphere.h"
+#include "plane.h"
+#include "material.h"
+#include "checker_texture.h"
+#include "paged_scene.h"
+
+#include <functional>
+#include <random>
+#include <vector>
+
+// The scene rendered by main: a checkered floor with a checkered, a matt and a metal sphere.
+void build_main_scene(hittable_list& world) {
+    //floor
+    auto ground_material = make_shared<checker_texture>(
+        color(0.2, 0.8, 0.2),  // green
+        color(1, 1, 1),  // white
+        20.0            // higher frequency = smaller checks
+    );
+
+    world.add(make_shared<plane>(point3(0, -0.5, -1.5), vec3(0, 1, 0), ground_material));
+
+
+    //sphere
+    auto checker_sphere_mat = make_shared<checker_texture>(
+        color(1, 0, 0),  // red
+        color(1, 1, 1),  // white
+        20.0            // higher frequency = smaller checks
+    );
+
+    world.add(make_shared<sphere>(point3(1.0, 0.1, -1.0), 0.5, checker_sphere_mat));
+
+
+    auto material_center = make_shared<lambertian>(color(0.1, 0.2, 0.5)); //matt colour
+    auto material_left   = make_shared<metal>(color(0.8, 0.8, 0.8)); //reflective metal
+
+    world.add(make_shared<sphere>(point3( 0.0,    0.0, -1.2),   0.5, material_center));
+    world.add(make_shared<sphere>(point3(-1.0,    0.0, -1.0),   0.5, material_left));
+}
+
+// Passes `count` small spheres scattered in front of the default camera to emit one at a time,
+// mostly diffuse with some checkered and metal ones. The same seed always produces the same
+// spheres.
+void for_each_random_sphere(size_t count, unsigned seed, const std::function<void(const sphere_record&)>& emit) {
+    std::mt19937 generator(seed);
+    std::uniform_real_distribution<double> unit(0.0, 1.0);
+    auto rnd = [&](double minimum, double maximum) { return minimum + (maximum - minimum) * unit(generator); };
+
+    for (size_t k = 0; k < count; k++) {
+        sphere_record record;
+        double radius = rnd(0.03, 0.15);
+        point3 center(rnd(-3.0, 3.0), -0.5 + radius + rnd(0.0, 0.8), rnd(-5.0, -1.0));
+        color albedo(rnd(0.1, 0.9), rnd(0.1, 0.9), rnd(0.1, 0.9));
+
+        double choice = unit(generator);
+        if (choice < 0.7)
+            record.type = sphere_record::lambertian_kind;
+        else if (choice < 0.85)
+            record.type = sphere_record::checker_kind;
+        else
+            record.type = sphere_record::metal_kind;
+
+        for (int a = 0; a < 3; a++) {
+            record.center[a] = center[a];
+            record.albedo[a] = float(albedo[a]);
+        }
+        record.radius = radius;
+        emit(record);
+    }
+}
+
+// The spheres of for_each_random_sphere, all in memory.
+std::vector<sphere_record> random_sphere_records(size_t count, unsigned seed = 1) {
+    std::vector<sphere_record> records;
+    records.reserve(count);
+    for_each_random_sphere(count, seed, [&records](const sphere_record& record) { records.push_back(record); });
+    return records;
+}
+
+void add_ground(hittable_list& world) {
+    auto ground_material = make_shared<checker_texture>(color(0.2, 0.8, 0.2), color(1, 1, 1), 20.0);
+    world.add(make_shared<plane>(point3(0, -0.5, -1.5), vec3(0, 1, 0), ground_material));
+}
+
+// The main scene's floor under random_sphere_records(count, seed).
+void build_random_scene(hittable_list& world, int count, unsigned seed = 1) {
+    add_ground(world);
+    for (const auto& record : random_sphere_records(size_t(count), seed))
+        world.add(make_shared<sphere>(record.make_sphere()));
+}
+
+#endif
@@ -0,0 +1,111 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads shared by everything that renders in a process.
+class thread_pool {
+  public:
+    explicit thread_pool(unsigned threads = std::thread::hardware_concurrency()) {
+        if (threads == 0)
+            threads = 1;
+        for (unsigned k = 0; k < threads; k++)
+            workers.emplace_back([this] { work(); });
+    }
+
+    thread_pool(const thread_pool&) = delete;
+    thread_pool& operator=(const thread_pool&) = delete;
+
+    ~thread_pool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto& worker : workers)
+            worker.join();
+    }
+
+    unsigned size() const { return unsigned(workers.size()); }
+
+    void submit(std::function<void()> task) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            tasks.push_back(std::move(task));
+        }
+        wake.notify_one();
+    }
+
+    void parallel_for(size_t count, const std::function<void(size_t)>& body) {
+        // Runs body(0) .. body(count-1) and returns once all of them have finished. Indices
+        // are handed out one at a time, so calls from several threads interleave their work
+        // on the pool. The calling thread works too, which keeps nested or concurrent calls
+        // from waiting on workers that are busy elsewhere.
+        if (count == 0)
+            return;
+
+        struct batch {
+            std::atomic<size_t> next{0};
+            std::atomic<size_t> done{0};
+            size_t count;
+            const std::function<void(size_t)>* body;
+            std::mutex mutex;
+            std::condition_variable finished;
+        };
+        auto state = std::make_shared<batch>();
+        state->count = count;
+        state->body = &body;
+
+        auto run = [state] {
+            size_t k;
+            while ((k = state->next++) < state->count) {
+                (*state->body)(k);
+                if (++state->done == state->count) {
+                    std::lock_guard<std::mutex> lock(state->mutex);
+                    state->finished.notify_all();
+                }
+            }
+        };
+
+        size_t helpers = std::min<size_t>(workers.size(), count - 1);
+        for (size_t k = 0; k < helpers; k++)
+            submit(run);
+        run();
+
+        std::unique_lock<std::mutex> lock(state->mutex);
+        state->finished.wait(lock, [&] { return state->done == state->count; });
+    }
+
+  private:
+    std::vector<std::thread> workers;
+    std::deque<std::function<void()>> tasks;
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool stopping = false;
+
+    void work() {
+        while (true) {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [this] { return stopping || !tasks.empty(); });
+                if (stopping && tasks.empty())
+                    return;
+                task = std::move(tasks.front());
+                tasks.pop_front();
+            }
+            task();
+        }
+    }
+};
+
+#endif